@@ -0,0 +1,291 @@
+/**
+  Table build / lookup / teardown benchmark: puts N entries into a table
+  sized for them, looks every key up, then frees the table, timing each
+  phase and measuring heap bytes per entry. Lookups go in a fixed random
+  order, one ht_get at a time ("get") and in batches of BATCH through
+  ht_get_many ("get_many"), then the table is rehashed to twice its size
+  ("rehash", on THREADS threads with -t). Layouts compared:
+    heap    strdup'd key and value handed to ht_put
+    arena   ht_strdup'd key and value in a table-owned arena
+    inline  ht_put_copy: node, key and value in one block
+    inl+ar  ht_put_copy with the arena
+    bin8    8-byte binary IDs through ht_put_n/ht_get_n (no get_many)
+    frozen  ht_freeze of the heap table (frozen.h): "build" is the
+            freeze, "get" is fz_get, bytes are the image's; no get_many
+            or rehash
+    loaded  ht_load of what ht_save wrote from the heap table: "build" is
+            the load, "get" is ht_get through the mapping, bytes are the
+            file's; no get_many or rehash
+
+  Entries are synthetic ("key%lu" => "val%lu") or, given a trace file, the
+  trace's puts.
+
+  Usage: buildbench [-n KEYS] [-r ROUNDS] [-t THREADS] [TRACEFILE]
+*/
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "frozen.h"
+#include "hashtable.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-result"
+
+#define BATCH 64
+
+static char **keys, **vals;
+static unsigned long n, *order, *ids, threads;
+
+static void add_entry(char *key, char *val) {
+  if ((n & (n - 1)) == 0) {
+    keys = realloc(keys, sizeof(char *) * (n ? n * 2 : 1));
+    vals = realloc(vals, sizeof(char *) * (n ? n * 2 : 1));
+  }
+  keys[n] = strdup(key);
+  vals[n] = strdup(val);
+  n++;
+}
+
+static int load_trace(char *filename) {
+  FILE *infile;
+  char buf[80], val[80];
+  int size;
+
+  if ((infile = fopen(filename, "r")) == NULL) {
+    printf("Error opening tracefile %s\n", filename);
+    return 0;
+  }
+  fscanf(infile, "%d", &size);
+  while (fscanf(infile, "%s", buf) != EOF) {
+    if (buf[0] == 'p') {
+      fscanf(infile, "%s %s", buf, val);
+      add_entry(buf, val);
+    }
+  }
+  fclose(infile);
+  return 1;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// copy: 0 hands over strings, 1 uses ht_put_copy, 2 puts binary IDs
+static void bench(char *name, int rounds, int arena, int copy) {
+  ht_opts_t opts = { 0 };
+  double t, build = 0, get = 0, get_many = 0, rehash = 0, teardown = 0, bytes = 0;
+  unsigned long i, j, found = 0, found_many = 0, entries = 0;
+  char *batch[BATCH];
+  void *out[BATCH];
+  size_t before;
+  hashtable_t *ht;
+  int r;
+
+  opts.arena = arena;
+  opts.rehash_threads = threads;
+  for (r = 0; r < rounds; r++) {
+    before = mallinfo2().uordblks;
+    ht = make_hashtable_opts(n, &opts);
+    t = now();
+    for (i = 0; i < n; i++) {
+      if (copy == 2)
+        ht_put_n(ht, memcpy(malloc(8), &ids[i], 8), 8, ht_strdup(ht, vals[i]));
+      else if (copy)
+        ht_put_copy(ht, keys[i], vals[i], strlen(vals[i]) + 1);
+      else
+        ht_put(ht, ht_strdup(ht, keys[i]), ht_strdup(ht, vals[i]));
+    }
+    build += now() - t;
+    entries = ht->count;
+    // malloc'd bytes, chunk overhead included, minus the bucket array
+    bytes = mallinfo2().uordblks - before - n * sizeof(bucket_t *);
+
+    t = now();
+    if (copy == 2) {
+      for (i = 0; i < n; i++)
+        found += ht_get_n(ht, (char *)&ids[order[i]], 8) != NULL;
+      found_many = found;
+    } else {
+      for (i = 0; i < n; i++)
+        found += ht_get(ht, keys[order[i]]) != NULL;
+    }
+    get += now() - t;
+
+    t = now();
+    for (i = 0; i < n && copy != 2; i += BATCH) {
+      for (j = 0; j < BATCH && i + j < n; j++)
+        batch[j] = keys[order[i + j]];
+      found_many += ht_get_many(ht, batch, j, out);
+    }
+    get_many += now() - t;
+
+    t = now();
+    ht_rehash(ht, n * 2);
+    rehash += now() - t;
+
+    t = now();
+    free_hashtable(ht);
+    teardown += now() - t;
+  }
+  if (found != n * rounds || found_many != n * rounds)
+    printf("lookup failures: %lu, batched %lu\n", n * rounds - found,
+           n * rounds - found_many);
+
+  printf("%-8s %10.1f %10.1f %10.1f %10.1f %10.1f %12.1f\n", name,
+         build * 1e9 / (n * rounds), get * 1e9 / (n * rounds),
+         get_many * 1e9 / (n * rounds), rehash * 1e9 / (n * rounds),
+         teardown * 1e9 / (n * rounds), bytes / entries);
+}
+
+static void bench_frozen(char *name, int rounds) {
+  double t, build = 0, get = 0, teardown = 0, bytes = 0;
+  unsigned long i, found = 0;
+  hashtable_t *ht;
+  frozen_t *f;
+  int r;
+
+  for (r = 0; r < rounds; r++) {
+    ht = make_hashtable(n);
+    for (i = 0; i < n; i++)
+      ht_put(ht, strdup(keys[i]), strdup(vals[i]));
+    t = now();
+    f = ht_freeze(ht, NULL);
+    build += now() - t;
+    free_hashtable(ht);
+    bytes = fz_bytes(f);
+
+    t = now();
+    for (i = 0; i < n; i++)
+      found += fz_get(f, keys[order[i]]) != NULL;
+    get += now() - t;
+
+    t = now();
+    free_frozen(f);
+    teardown += now() - t;
+  }
+  if (found != n * rounds)
+    printf("lookup failures: %lu\n", n * rounds - found);
+
+  printf("%-8s %10.1f %10.1f %10s %10s %10.1f %12.1f\n", name,
+         build * 1e9 / (n * rounds), get * 1e9 / (n * rounds), "-", "-",
+         teardown * 1e9 / (n * rounds), bytes / n);
+}
+
+static void bench_loaded(char *name, int rounds) {
+  double t, build = 0, get = 0, teardown = 0, bytes = 0;
+  char path[] = "/tmp/buildbench-XXXXXX";
+  unsigned long i, found = 0;
+  hashtable_t *ht;
+  int r;
+
+  close(mkstemp(path));
+  ht = make_hashtable(n);
+  for (i = 0; i < n; i++)
+    ht_put(ht, strdup(keys[i]), strdup(vals[i]));
+  ht_save(ht, path, NULL);
+  free_hashtable(ht);
+
+  for (r = 0; r < rounds; r++) {
+    t = now();
+    ht = ht_load(path, n, NULL);
+    build += now() - t;
+
+    t = now();
+    for (i = 0; i < n; i++)
+      found += ht_get(ht, keys[order[i]]) != NULL;
+    get += now() - t;
+
+    ht_stats_t st;
+    ht_stats(ht, &st);
+    bytes = st.snap_bytes;
+    t = now();
+    free_hashtable(ht);
+    teardown += now() - t;
+  }
+  unlink(path);
+  if (found != n * rounds)
+    printf("lookup failures: %lu\n", n * rounds - found);
+
+  printf("%-8s %10.1f %10.1f %10s %10s %10.1f %12.1f\n", name,
+         build * 1e9 / (n * rounds), get * 1e9 / (n * rounds), "-", "-",
+         teardown * 1e9 / (n * rounds), bytes / n);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long count = 1000000, i;
+  int rounds = 3, c;
+  char buf[64], val[64];
+
+  while ((c = getopt(argc, argv, "n:r:t:")) != -1) {
+    switch (c) {
+    case 'n':
+      count = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      rounds = atoi(optarg);
+      break;
+    case 't':
+      threads = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      printf("Usage: %s [-n KEYS] [-r ROUNDS] [-t THREADS] [TRACEFILE]\n", argv[0]);
+      exit(0);
+    }
+  }
+
+  if (optind < argc) {
+    if (!load_trace(argv[optind]))
+      exit(1);
+  } else {
+    for (i = 0; i < count; i++) {
+      snprintf(buf, sizeof(buf), "key%lu", i);
+      snprintf(val, sizeof(val), "val%lu", i);
+      add_entry(buf, val);
+    }
+  }
+
+  // fixed-width binary stand-ins for the keys, spread over all 8 bytes
+  ids = malloc(n * sizeof(unsigned long));
+  for (i = 0; i < n; i++)
+    ids[i] = i * 0x9e3779b97f4a7c15UL;
+
+  // look keys up in random order, so lookups don't ride on insert order
+  order = malloc(n * sizeof(unsigned long));
+  for (i = 0; i < n; i++)
+    order[i] = i;
+  srand(1);
+  for (i = n; i > 1; i--) {
+    unsigned long j = (unsigned long)rand() % i, tmp = order[i - 1];
+    order[i - 1] = order[j];
+    order[j] = tmp;
+  }
+
+  // ns per put / get / batched get / rehash / free, heap bytes per live entry
+  printf("%-8s %10s %10s %10s %10s %10s %12s\n", "layout", "build", "get",
+         "get_many", "rehash", "teardown", "bytes/entry");
+  bench("heap", rounds, 0, 0);
+  bench("arena", rounds, 1, 0);
+  bench("inline", rounds, 0, 1);
+  bench("inl+ar", rounds, 1, 1);
+  bench("bin8", rounds, 0, 2);
+  bench_frozen("frozen", rounds);
+  bench_loaded("loaded", rounds);
+
+  for (i = 0; i < n; i++) {
+    free(keys[i]);
+    free(vals[i]);
+  }
+  free(keys);
+  free(vals);
+  free(order);
+  free(ids);
+  return 0;
+}
+
+#pragma GCC diagnostic pop
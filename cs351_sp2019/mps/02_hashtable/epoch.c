@@ -0,0 +1,180 @@
+/**
+  Epoch-based reclamation (Fraser's three-epoch scheme).
+
+  The global epoch only moves from e to e+1 once every thread inside a
+  critical section has announced e, so while the global epoch is e no reader
+  can still hold anything retired during e-2 or earlier. Each thread keeps
+  three bags of retired pointers, one per epoch mod 3, and empties a bag
+  once the global epoch is two past the bag's.
+
+  Thread records are never freed: a record left by an exited thread is
+  picked up, bags and all, by the next thread that needs one.
+*/
+
+#include "epoch.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+// retirements between attempts to advance the epoch and empty bags
+#define EPOCH_BATCH 64
+
+typedef struct retired {
+  void *p;
+  void (*fn)(void *);
+} retired_t;
+
+typedef struct bag {
+  unsigned long epoch;
+  unsigned long n, cap;
+  retired_t *items;
+} bag_t;
+
+typedef struct epoch_rec {
+  unsigned long state;   // (epoch << 1) | 1 while inside, 0 outside
+  unsigned long nest;
+  int in_use;
+  unsigned long pending;
+  bag_t bags[3];
+  struct epoch_rec *next;
+} epoch_rec_t;
+
+static unsigned long global_epoch = 2;
+static epoch_rec_t *registry;
+static __thread epoch_rec_t *self;
+static pthread_key_t release_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+// thread exit: hand the record (and its unfreed bags) to the next thread
+static void epoch_release(void *arg) {
+  epoch_rec_t *rec = arg;
+  __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+  rec->nest = 0;
+  __atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void epoch_make_key(void) {
+  pthread_key_create(&release_key, epoch_release);
+}
+
+static epoch_rec_t *epoch_self(void) {
+
+  epoch_rec_t *rec;
+  int unused = 0;
+
+  if (self)
+    return self;
+
+  // reuse a record some exited thread left behind
+  for (rec = __atomic_load_n(&registry, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+    if (__atomic_compare_exchange_n(&rec->in_use, &unused, 1, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      break;
+    unused = 0;
+  }
+
+  if (!rec) {
+    rec = calloc(1, sizeof(epoch_rec_t));
+    rec->in_use = 1;
+    rec->next = __atomic_load_n(&registry, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&registry, &rec->next, rec, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+
+  pthread_once(&key_once, epoch_make_key);
+  pthread_setspecific(release_key, rec);
+  return self = rec;
+}
+
+void epoch_enter(void) {
+
+  epoch_rec_t *rec = epoch_self();
+
+  if (rec->nest++ == 0) {
+    unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->state, (e << 1) | 1, __ATOMIC_RELAXED);
+    // the announcement must be visible before any shared pointer is read
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }
+}
+
+void epoch_exit(void) {
+
+  epoch_rec_t *rec = self;
+
+  if (--rec->nest == 0)
+    __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+}
+
+static void bag_free(bag_t *bag) {
+  unsigned long i;
+  for (i = 0; i < bag->n; i++)
+    bag->items[i].fn(bag->items[i].p);
+  bag->n = 0;
+}
+
+// move the global epoch forward if every active thread has caught up
+static void epoch_try_advance(void) {
+
+  unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+  epoch_rec_t *rec;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (rec = __atomic_load_n(&registry, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+    unsigned long state = __atomic_load_n(&rec->state, __ATOMIC_ACQUIRE);
+    if ((state & 1) && (state >> 1) != e)
+      return;
+  }
+  __atomic_compare_exchange_n(&global_epoch, &e, e + 1, 0,
+                              __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+// empty this thread's bags that are now two epochs old
+static void epoch_collect(epoch_rec_t *rec) {
+
+  unsigned long e, i;
+
+  epoch_try_advance();
+  e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+  rec->pending = 0;
+  for (i = 0; i < 3; i++) {
+    if (rec->bags[i].epoch + 2 <= e)
+      bag_free(&rec->bags[i]);
+    rec->pending += rec->bags[i].n;
+  }
+}
+
+void epoch_retire(void *p, void (*fn)(void *)) {
+
+  epoch_rec_t *rec = epoch_self();
+  unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+  bag_t *bag = &rec->bags[e % 3];
+
+  // a bag for this slot from three or more epochs back is already safe
+  if (bag->epoch != e) {
+    bag_free(bag);
+    bag->epoch = e;
+  }
+  if (bag->n == bag->cap) {
+    bag->cap = bag->cap ? bag->cap * 2 : EPOCH_BATCH;
+    bag->items = realloc(bag->items, bag->cap * sizeof(retired_t));
+  }
+  bag->items[bag->n].p = p;
+  bag->items[bag->n].fn = fn;
+  bag->n++;
+
+  if (++rec->pending >= EPOCH_BATCH)
+    epoch_collect(rec);
+}
+
+void epoch_quiesce(void) {
+
+  epoch_rec_t *rec;
+  int i;
+
+  for (rec = __atomic_load_n(&registry, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+    for (i = 0; i < 3; i++)
+      bag_free(&rec->bags[i]);
+    rec->pending = 0;
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef EPOCH_T
+#define EPOCH_T
+
+/**
+ * Epoch-based reclamation for the thread-safe table's lock-free readers.
+ *
+ * A reader brackets its access with epoch_enter/epoch_exit. Memory a writer
+ * has unlinked goes to epoch_retire instead of free; it is released only
+ * once every thread that was inside a critical section at the time has left
+ * it (two epoch advances later). Critical sections nest, and are cheap: one
+ * store and one fence on entry, one store on exit.
+ */
+
+/** Start a read-side critical section for the calling thread. */
+void epoch_enter(void);
+/** End it; pointers read inside must not be used afterwards. */
+void epoch_exit(void);
+/** Free p with fn once no reader can still hold it. */
+void epoch_retire(void *p, void (*fn)(void *));
+/** Free everything retired by any thread. Only call while no other thread
+    uses the table or these functions, e.g. after joining the workers. */
+void epoch_quiesce(void);
+
+#endif
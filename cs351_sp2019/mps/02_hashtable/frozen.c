@@ -0,0 +1,416 @@
+#include "frozen.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FZ_ALIGN(x) (((x) + 7) & ~7UL)
+#define FZ_MIX   0x9e3779b97f4a7c15UL
+#define FZ_SEEDS 8  // seeds tried before ht_freeze gives up
+
+typedef struct fz_entry {
+  unsigned int klen, vlen;
+  char key[];  // klen bytes and a NUL, then the value at FZ_ALIGN
+} fz_entry_t;
+
+static inline void *fz_val(fz_entry_t *e) {
+  return (char *)e + FZ_ALIGN(sizeof(fz_entry_t) + e->klen + 1);
+}
+
+/* Entry slot s points at, NULL for a spare slot. fz_load checks no more
+   than the header, so this is where a damaged file is caught: an entry
+   that doesn't lie whole inside the image, key NUL and value included,
+   is taken for a spare slot too. */
+static inline fz_entry_t *fz_entry(frozen_t *f, unsigned long s) {
+  fz_header_t *hdr = f->hdr;
+  unsigned long pos = 8UL * f->slots[s];
+  fz_entry_t *e = (fz_entry_t *)((char *)hdr + pos);
+
+  // also spare slots: their 0 is below the entries
+  if (pos < hdr->entries || pos > hdr->size - sizeof(fz_entry_t))
+    return NULL;
+  if (FZ_ALIGN(sizeof(fz_entry_t) + e->klen + 1) + e->vlen > hdr->size - pos ||
+      e->key[e->klen] != '\0')
+    return NULL;
+  return e;
+}
+
+// x scaled onto [0, n) by its high bits; no division
+static inline unsigned long fz_range(unsigned long x, unsigned long n) {
+  return (unsigned long)(((unsigned __int128)x * n) >> 64);
+}
+
+/* Group of a key with hash h: skewed as in PTHash, 60% of the keys into
+   the first 30% of the groups. Those big groups are placed first, while
+   most slots are free, which leaves small ones for the crowded end. */
+static inline unsigned long fz_group(unsigned long h, unsigned long ngroups) {
+  unsigned long dense = ngroups * 3 / 10 + 1;
+  unsigned long x = h * FZ_MIX;  // other bits than the test below
+
+  if (h < 0x9999999999999999UL)  // 0.6 * 2^64
+    return fz_range(x, dense);
+  return dense + fz_range(x, ngroups - dense);
+}
+
+// slot of a key with hash h when its group has this pilot
+static inline unsigned long fz_slot(unsigned long h, unsigned long pilot,
+                                    unsigned long n) {
+  unsigned long x = h ^ (pilot + 1) * FZ_MIX;
+  x ^= x >> 31;
+  x *= 0xbf58476d1ce4e5b9UL;
+  x ^= x >> 29;
+  return fz_range(x, n);
+}
+
+static void fz_bind(frozen_t *f, fz_header_t *hdr) {
+  f->hdr = hdr;
+  f->pilots = (unsigned int *)((char *)hdr + hdr->pilots);
+  f->slots = (unsigned int *)((char *)hdr + hdr->slots);
+}
+
+/* Find a pilot for every group under seed, biggest groups first while most
+   slots are free, and fill the slots. Entry i has key src[i] and offset
+   off[i] (in 8 bytes, never 0); h[i] is filled in here. f need only hold
+   the header, pilots and slots. Returns 0, with the slots untouched, if
+   some group found no pilot. */
+static int fz_place(frozen_t *f, ht_entry_t *src, unsigned int *off,
+                    unsigned long *h, unsigned long seed) {
+  unsigned long n = f->hdr->n, ngroups = f->hdr->ngroups, m = f->hdr->nslots;
+  unsigned long i, g, k, p, s, maxsize = 0;
+  unsigned long limit = n * 64 + 4096 < UINT_MAX ? n * 64 + 4096 : UINT_MAX;
+  unsigned long *start = calloc(ngroups + 1, sizeof(unsigned long));
+  unsigned long *member = malloc(n * sizeof(unsigned long));
+  unsigned long *order = malloc(ngroups * sizeof(unsigned long));
+  unsigned long *bysize;
+  // slots taken so far, a bit each: small enough to stay in cache
+  unsigned long *taken = calloc(m / 64 + 1, sizeof(unsigned long));
+  int ok = 1;
+
+  // entries grouped by group (counting sort)
+  for (i = 0; i < n; i++) {
+    h[i] = hash_wy(src[i].key, src[i].klen, seed);
+    start[fz_group(h[i], ngroups) + 1]++;
+  }
+  for (g = 0; g < ngroups; g++) {
+    if (maxsize < start[g + 1])
+      maxsize = start[g + 1];
+    start[g + 1] += start[g];
+  }
+  bysize = calloc(maxsize + 2, sizeof(unsigned long));
+  for (g = 0; g < ngroups; g++)
+    bysize[maxsize - (start[g + 1] - start[g]) + 1]++;
+  for (k = 0; k <= maxsize; k++)
+    bysize[k + 1] += bysize[k];
+  for (g = 0; g < ngroups; g++)
+    order[bysize[maxsize - (start[g + 1] - start[g])]++] = g;
+  for (i = 0; i < n; i++)
+    member[start[fz_group(h[i], ngroups)]++] = i;
+  // start[g] is now where group g + 1 starts
+  for (g = ngroups; g > 0; g--)
+    start[g] = start[g - 1];
+  start[0] = 0;
+
+  for (i = 0; i < ngroups && ok; i++) {
+    unsigned long first = start[order[i]], last = start[order[i] + 1];
+    if (first == last)
+      break;
+    for (p = 0; p < limit; p++) {
+      // claim a slot per member; on a clash give back those claimed
+      for (k = first; k < last; k++) {
+        s = fz_slot(h[member[k]], p, m);
+        if (taken[s / 64] & 1UL << s % 64)
+          break;
+        taken[s / 64] |= 1UL << s % 64;
+      }
+      if (k == last)
+        break;
+      while (k-- > first) {
+        s = fz_slot(h[member[k]], p, m);
+        taken[s / 64] &= ~(1UL << s % 64);
+      }
+    }
+    f->pilots[order[i]] = p;
+    ok = p < limit;
+  }
+  for (i = 0; i < n && ok; i++) {
+    g = fz_group(h[i], ngroups);
+    f->slots[fz_slot(h[i], f->pilots[g], m)] = off[i];
+  }
+
+  free(start);
+  free(member);
+  free(order);
+  free(bysize);
+  free(taken);
+  return ok;
+}
+
+/* A table's entries and the layout of their image, as ht_freeze and
+   ht_freeze_save both need them: src points into the table, vl has the
+   value lengths, off each entry's offset in 8 bytes, and hdr is the
+   image's header but for the seed. */
+typedef struct fz_build {
+  ht_entry_t *src;
+  unsigned long *vl;
+  unsigned int *off;
+  fz_header_t hdr;
+} fz_build_t;
+
+static void fz_build_free(fz_build_t *b) {
+  free(b->src);
+  free(b->vl);
+  free(b->off);
+}
+
+// 0, with nothing held, if the image can't take the table
+static int fz_collect(fz_build_t *b, hashtable_t *ht, unsigned long (*vlen)(void *val)) {
+  ht_scan_out_t out = { 0 };
+  unsigned long n = 0, cap = 0, cursor = 0, i, pos, size;
+  int fits = 1;
+
+  memset(b, 0, sizeof(fz_build_t));
+  // every entry, once: a walk of an unchanging table repeats none
+  do {
+    cursor = ht_scan(ht, cursor, 1024, &out);
+    if (out.n == 0)
+      continue;
+    if (n + out.n > cap) {
+      cap = (n + out.n) * 2;
+      b->src = realloc(b->src, cap * sizeof(ht_entry_t));
+    }
+    memcpy(b->src + n, out.entries, out.n * sizeof(ht_entry_t));
+    n += out.n;
+  } while (cursor);
+  free(out.entries);
+
+  memcpy(b->hdr.magic, FZ_MAGIC, sizeof(b->hdr.magic));
+  b->hdr.n = n;
+  b->hdr.nslots = FZ_SLOTS(n);
+  b->hdr.ngroups = FZ_GROUPS(n);
+  b->hdr.pilots = FZ_ALIGN(sizeof(fz_header_t));
+  b->hdr.slots = FZ_ALIGN(b->hdr.pilots + b->hdr.ngroups * sizeof(unsigned int));
+  b->hdr.entries = FZ_ALIGN(b->hdr.slots + b->hdr.nslots * sizeof(unsigned int));
+  b->vl = malloc((n + 1) * sizeof(unsigned long));
+  size = b->hdr.entries;
+  for (i = 0; i < n; i++) {
+    b->vl[i] = vlen ? vlen(b->src[i].val) : strlen(b->src[i].val) + 1;
+    // lengths are stored in 32 bits, offsets in 32 bits of 8 bytes
+    fits = fits && b->src[i].klen < UINT_MAX && b->vl[i] <= UINT_MAX;
+    size += FZ_ALIGN(sizeof(fz_entry_t) + b->src[i].klen + 1) + FZ_ALIGN(b->vl[i]);
+  }
+  if (!fits || size / 8 > UINT_MAX) {
+    fz_build_free(b);
+    return 0;
+  }
+  b->hdr.size = size;
+  b->off = malloc((n + 1) * sizeof(unsigned int));
+  for (i = 0, pos = b->hdr.entries; i < n; i++) {
+    b->off[i] = pos / 8;
+    pos += FZ_ALIGN(sizeof(fz_entry_t) + b->src[i].klen + 1) + FZ_ALIGN(b->vl[i]);
+  }
+  return 1;
+}
+
+// pilots and slots into f for the first seed that works; 0 if none does
+static int fz_index(fz_build_t *b, frozen_t *f) {
+  unsigned long *h = malloc((b->hdr.n + 1) * sizeof(unsigned long));
+  int attempt;
+
+  for (attempt = 0; attempt < FZ_SEEDS; attempt++) {
+    f->hdr->seed = attempt * FZ_MIX;
+    if (fz_place(f, b->src, b->off, h, f->hdr->seed))
+      break;
+  }
+  free(h);
+  return attempt < FZ_SEEDS;
+}
+
+frozen_t *ht_freeze(hashtable_t *ht, unsigned long (*vlen)(void *val)) {
+  fz_build_t b;
+  fz_header_t *hdr;
+  frozen_t *f;
+  unsigned long i;
+  int ok;
+
+  if (!fz_collect(&b, ht, vlen))
+    return NULL;
+  // zeroed, so padding is too and equal tables save equal files
+  hdr = calloc(1, b.hdr.size);
+  *hdr = b.hdr;
+  f = calloc(1, sizeof(frozen_t));
+  fz_bind(f, hdr);
+  for (i = 0; i < b.hdr.n; i++) {
+    fz_entry_t *e = (fz_entry_t *)((char *)hdr + 8UL * b.off[i]);
+    e->klen = b.src[i].klen;
+    e->vlen = b.vl[i];
+    memcpy(e->key, b.src[i].key, b.src[i].klen);
+    memcpy(fz_val(e), b.src[i].val, b.vl[i]);
+  }
+  ok = fz_index(&b, f);
+  fz_build_free(&b);
+  if (!ok) {
+    free_frozen(f);
+    return NULL;
+  }
+  return f;
+}
+
+long fz_find_n(frozen_t *f, char *key, unsigned long len) {
+  fz_header_t *hdr = f->hdr;
+  unsigned long h, s;
+  fz_entry_t *e;
+
+  if (hdr->n == 0)
+    return -1;
+  h = hash_wy(key, len, hdr->seed);
+  s = fz_slot(h, f->pilots[fz_group(h, hdr->ngroups)], hdr->nslots);
+  e = fz_entry(f, s);
+  if (!e || e->klen != len || memcmp(e->key, key, len) != 0)
+    return -1;
+  return s;
+}
+
+void *fz_at(frozen_t *f, unsigned long s, char **key, unsigned long *klen) {
+  fz_entry_t *e = fz_entry(f, s);
+
+  if (!e)
+    return NULL;
+  if (key)
+    *key = e->key;
+  if (klen)
+    *klen = e->klen;
+  return fz_val(e);
+}
+
+void *fz_get_n(frozen_t *f, char *key, unsigned long len) {
+  long s = fz_find_n(f, key, len);
+  return s < 0 ? NULL : fz_at(f, s, NULL, NULL);
+}
+
+void *fz_get(frozen_t *f, char *key) {
+  return fz_get_n(f, key, strlen(key));
+}
+
+void fz_iter(frozen_t *f, int (*fn)(char *key, void *val)) {
+  char *key;
+  void *val;
+
+  for (unsigned long s = 0; s < f->hdr->nslots; s++) {
+    if ((val = fz_at(f, s, &key, NULL)) && !fn(key, val))
+      break;
+  }
+}
+
+/* Files are written aside, to path.tmp, and renamed over path once
+   complete, so mappings of the old file stay as they were. */
+static FILE *fz_create(const char *path, char **tmp) {
+  FILE *out;
+
+  *tmp = malloc(strlen(path) + 5);
+  sprintf(*tmp, "%s.tmp", path);
+  if (!(out = fopen(*tmp, "wb")))
+    free(*tmp);
+  return out;
+}
+
+static int fz_commit(FILE *out, char *tmp, const char *path, int ok) {
+  ok = fclose(out) == 0 && ok && rename(tmp, path) == 0;
+  if (!ok)
+    unlink(tmp);
+  free(tmp);
+  return ok;
+}
+
+int fz_save(frozen_t *f, const char *path) {
+  char *tmp;
+  FILE *out = fz_create(path, &tmp);
+
+  if (!out)
+    return 0;
+  return fz_commit(out, tmp, path, fwrite(f->hdr, 1, f->hdr->size, out) == f->hdr->size);
+}
+
+int ht_freeze_save(hashtable_t *ht, const char *path, unsigned long (*vlen)(void *val)) {
+  static const char zero[8];
+  fz_build_t b;
+  fz_entry_t e;
+  frozen_t f = { 0 };
+  char *tmp;
+  FILE *out;
+  unsigned long i, pad;
+  int ok;
+
+  if (!fz_collect(&b, ht, vlen))
+    return 0;
+  // only the index is built here: header, pilots, slots
+  f.hdr = calloc(1, b.hdr.entries);
+  *f.hdr = b.hdr;
+  fz_bind(&f, f.hdr);
+  if (!fz_index(&b, &f) || !(out = fz_create(path, &tmp))) {
+    free(f.hdr);
+    fz_build_free(&b);
+    return 0;
+  }
+  ok = fwrite(f.hdr, 1, b.hdr.entries, out) == b.hdr.entries;
+  // then each entry as ht_freeze lays it out, straight from the table
+  for (i = 0; i < b.hdr.n && ok; i++) {
+    e.klen = b.src[i].klen;
+    e.vlen = b.vl[i];
+    pad = FZ_ALIGN(sizeof(e) + e.klen + 1) - (sizeof(e) + e.klen);
+    ok = fwrite(&e, sizeof(e), 1, out) == 1 &&
+         fwrite(b.src[i].key, 1, e.klen, out) == e.klen &&
+         fwrite(zero, 1, pad, out) == pad &&
+         fwrite(b.src[i].val, 1, e.vlen, out) == e.vlen &&
+         fwrite(zero, 1, FZ_ALIGN(e.vlen) - e.vlen, out) == FZ_ALIGN(e.vlen) - e.vlen;
+  }
+  free(f.hdr);
+  fz_build_free(&b);
+  return fz_commit(out, tmp, path, ok);
+}
+
+frozen_t *fz_load(const char *path) {
+  struct stat st;
+  fz_header_t *hdr;
+  frozen_t *f;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) != 0 || (unsigned long)st.st_size < sizeof(fz_header_t)) {
+    close(fd);
+    return NULL;
+  }
+  hdr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (hdr == MAP_FAILED)
+    return NULL;
+  // the arrays must be where a frozen table of n entries has them; a slot
+  // takes 4 bytes, so an n past size / 4 can't be, and would overflow
+  if (memcmp(hdr->magic, FZ_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->size != (unsigned long)st.st_size || hdr->n > hdr->size / 4 ||
+      hdr->ngroups != FZ_GROUPS(hdr->n) ||
+      hdr->pilots != FZ_ALIGN(sizeof(fz_header_t)) ||
+      hdr->slots != FZ_ALIGN(hdr->pilots + hdr->ngroups * sizeof(unsigned int)) ||
+      hdr->nslots != FZ_SLOTS(hdr->n) ||
+      hdr->entries != FZ_ALIGN(hdr->slots + hdr->nslots * sizeof(unsigned int)) ||
+      hdr->entries > hdr->size) {
+    munmap(hdr, st.st_size);
+    return NULL;
+  }
+  f = calloc(1, sizeof(frozen_t));
+  fz_bind(f, hdr);
+  f->mapped = 1;
+  return f;
+}
+
+void free_frozen(frozen_t *f) {
+  if (f->mapped)
+    munmap(f->hdr, f->hdr->size);
+  else
+    free(f->hdr);
+  free(f);
+}
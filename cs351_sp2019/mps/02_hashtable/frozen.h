@@ -0,0 +1,104 @@
+#ifndef FROZEN_T
+#define FROZEN_T
+
+#include "hashtable.h"
+
+/**
+ * Frozen table: an immutable copy of a hashtable's entries behind a perfect
+ * hash (CHD / PTHash style). n keys are hashed into about n / FZ_LAMBDA
+ * groups; each group stores the pilot that sends all of its keys to
+ * distinct slots, of which there are FZ_SLOTS(n), 1% more than keys. A get
+ * reads the key's pilot, its slot and the entry the slot points at, so it
+ * compares at most one key whatever it looks up. Slots are 4-byte offsets
+ * and the entries are packed back to back, so the spare slots cost 0.04
+ * bytes per key.
+ *
+ * Everything lives in one image with offsets instead of pointers: header,
+ * pilots, slots, then the entries (key length, value length, key bytes
+ * and a NUL, value bytes, each part 8-byte aligned). fz_save writes that
+ * image as it is and fz_load maps it back read-only; nothing is rebuilt,
+ * and pages come in as gets touch them. The file is in the byte order
+ * of the machine that wrote it.
+ *
+ * The frozen table hashes with hash_wy under a seed of its own, whatever
+ * the source table used, and only copies bytes: values must be byte
+ * strings of a length the caller can tell (see ht_freeze).
+ */
+
+typedef struct fz_header {
+  char magic[8];             // FZ_MAGIC
+  unsigned long size;        // bytes in the image, header included
+  unsigned long n;           // entries
+  unsigned long nslots;      // FZ_SLOTS(n)
+  unsigned long ngroups;     // pilots
+  unsigned long seed;        // hash_wy seed the pilots were found for
+  unsigned long pilots, slots, entries;  // offsets of the three arrays
+} fz_header_t;
+
+typedef struct frozen {
+  fz_header_t *hdr;         // start of the image
+  unsigned int *pilots;
+  unsigned int *slots;      // entry offsets, in 8-byte units
+  int mapped;               // image is fz_load's mapping, not malloc'd
+} frozen_t;
+
+#define FZ_MAGIC  "HTFROZ01"
+#define FZ_LAMBDA 4         // average keys per pilot group
+// groups for n keys, at least the two fz_group splits them into
+#define FZ_GROUPS(n) ((n) / FZ_LAMBDA + 2)
+// slots for n keys: about 1% spare, so the last groups find pilots fast
+#define FZ_SLOTS(n) ((n) + (n) / 99 + 1)
+
+/** Frozen copy of ht's entries, taken through ht_scan so any backend will
+    do; ht must not change meanwhile and is left as it was. Each value is
+    copied as vlen(val) bytes, or as a NUL-terminated string if vlen is
+    NULL. NULL if the image would pass 32 GB or a key or value 4 GB.*/
+frozen_t *ht_freeze(hashtable_t *ht, unsigned long (*vlen)(void *val));
+
+/** The frozen copy of key's value, or NULL; it is 8-byte aligned and lives
+    as long as f.*/
+void *fz_get(frozen_t *f, char *key);
+void *fz_get_n(frozen_t *f, char *key, unsigned long len);
+
+/** Slot of the len bytes at key, below fz_slots(f); -1 if f lacks them.*/
+long  fz_find_n(frozen_t *f, char *key, unsigned long len);
+/** Value of the entry in slot s, its key and key length to *key and *klen
+    unless NULL; NULL for one of the spare slots.*/
+void *fz_at(frozen_t *f, unsigned long s, char **key, unsigned long *klen);
+
+/** Call fn on every entry in slot order until it returns 0, as ht_iter.*/
+void  fz_iter(frozen_t *f, int (*fn)(char *key, void *val));
+
+static inline unsigned long fz_count(frozen_t *f) {
+  return f->hdr->n;
+}
+
+static inline unsigned long fz_slots(frozen_t *f) {
+  return f->hdr->nslots;
+}
+
+/** Bytes of the image: all that f holds, and the size of its file.*/
+static inline unsigned long fz_bytes(frozen_t *f) {
+  return f->hdr->size;
+}
+
+/** fz_save(ht_freeze(ht, vlen), path) without the image in memory: only
+    its index (header, pilots and slots, about 5 bytes a key) is built, and
+    the entries are written straight from ht, which must not change
+    meanwhile. Besides the index this holds a pointer pair and a few words
+    per entry while placing keys. Gives the same file; 0 on failure.*/
+int   ht_freeze_save(hashtable_t *ht, const char *path, unsigned long (*vlen)(void *val));
+
+/** Write the image to path; 0 and errno on failure. The file is replaced
+    whole (written to path.tmp, then renamed), so anything mapping the old
+    one, even f itself, keeps reading the old one.*/
+int   fz_save(frozen_t *f, const char *path);
+/** Map a file fz_save wrote; NULL if it can't be opened or its header
+    isn't one. The rest is checked as it is read, so a damaged file costs
+    nothing up front: entries lying outside it read as missing keys, though
+    fz_count still says what the header says.*/
+frozen_t *fz_load(const char *path);
+
+void  free_frozen(frozen_t *f);
+
+#endif
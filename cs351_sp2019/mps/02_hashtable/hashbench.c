@@ -0,0 +1,202 @@
+/**
+  Hash function benchmark: hashing throughput and the chain lengths each
+  function gives on the trace keys and on large synthetic key sets.
+
+  Usage: hashbench [-n KEYS] [-r ROUNDS] [TRACEFILE...]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hashtable.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-result"
+
+typedef struct keyset {
+  char name[64];
+  unsigned long n;
+  char **keys;
+  unsigned long *lens;
+  unsigned long bytes;
+} keyset_t;
+
+static void add_key(keyset_t *ks, char *key) {
+  if ((ks->n & (ks->n - 1)) == 0) {
+    // grow by doubling at each power of two
+    ks->keys = realloc(ks->keys, sizeof(char *) * (ks->n ? ks->n * 2 : 1));
+    ks->lens = realloc(ks->lens, sizeof(unsigned long) * (ks->n ? ks->n * 2 : 1));
+  }
+  ks->keys[ks->n] = key;
+  ks->lens[ks->n] = strlen(key);
+  ks->bytes += ks->lens[ks->n];
+  ks->n++;
+}
+
+// distinct keys of the p/g/d lines in a trace file
+static int load_trace(keyset_t *ks, char *filename) {
+  FILE *infile;
+  hashtable_t *seen;
+  char buf[80];
+  int size;
+
+  if ((infile = fopen(filename, "r")) == NULL) {
+    printf("Error opening tracefile %s\n", filename);
+    return 0;
+  }
+  snprintf(ks->name, sizeof(ks->name), "%s", filename);
+  seen = make_hashtable(1024);
+  fscanf(infile, "%d", &size);
+  while (fscanf(infile, "%s", buf) != EOF) {
+    switch (buf[0]) {
+    case 'p':
+      fscanf(infile, "%s", buf);
+      if (!ht_get(seen, buf)) {
+        add_key(ks, strdup(buf));
+        ht_put(seen, strdup(buf), strdup(""));
+      }
+      fscanf(infile, "%s", buf);
+      break;
+    case 'g':
+    case 'd':
+      fscanf(infile, "%s", buf);
+      if (!ht_get(seen, buf)) {
+        add_key(ks, strdup(buf));
+        ht_put(seen, strdup(buf), strdup(""));
+      }
+      break;
+    case 'r':
+      fscanf(infile, "%d", &size);
+      break;
+    }
+  }
+  free_hashtable(seen);
+  fclose(infile);
+  return 1;
+}
+
+// n keys printed through fmt from 0..n-1
+static void make_synthetic(keyset_t *ks, char *name, char *fmt, unsigned long n) {
+  char buf[128];
+  unsigned long i;
+
+  snprintf(ks->name, sizeof(ks->name), "%s", name);
+  for (i = 0; i < n; i++) {
+    snprintf(buf, sizeof(buf), fmt, i);
+    add_key(ks, strdup(buf));
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// volatile sink so the compiler can't drop the timed hashing
+static volatile unsigned long sink;
+
+static void bench(keyset_t *ks, const struct hash_entry *e, int rounds) {
+  unsigned long i, h = 0, *counts;
+  unsigned long size = ks->n, max_len = 0, chains = 0, pow2 = 1, pow2_max = 0;
+  double t, sumsq = 0;
+  int r;
+
+  // throughput: all keys, several rounds
+  t = now();
+  for (r = 0; r < rounds; r++) {
+    for (i = 0; i < ks->n; i++)
+      h += e->fn(ks->keys[i], ks->lens[i], 0);
+  }
+  t = now() - t;
+  sink = h;
+
+  // distribution with one bucket per key, like a table at load factor 1
+  counts = calloc(size, sizeof(unsigned long));
+  for (i = 0; i < ks->n; i++)
+    counts[e->fn(ks->keys[i], ks->lens[i], 0) % size]++;
+  for (i = 0; i < size; i++) {
+    if (counts[i]) {
+      chains++;
+      sumsq += (double)counts[i] * counts[i];
+    }
+    if (max_len < counts[i])
+      max_len = counts[i];
+  }
+  free(counts);
+
+  // and with a power of two of buckets, where only the low bits count
+  while (pow2 < size)
+    pow2 *= 2;
+  counts = calloc(pow2, sizeof(unsigned long));
+  for (i = 0; i < ks->n; i++) {
+    h = e->fn(ks->keys[i], ks->lens[i], 0) & (pow2 - 1);
+    if (++counts[h] > pow2_max)
+      pow2_max = counts[h];
+  }
+  free(counts);
+
+  // a uniform hash at load 1 expects sum(len^2) = 2 * keys
+  printf("%-14s %-6s %9.2f %9.1f %8lu %8.3f %8.3f %9lu\n",
+         ks->name, e->name,
+         t * 1e9 / ((double)ks->n * rounds),
+         (double)ks->bytes * rounds / t / 1e6,
+         max_len, (double)ks->n / chains,
+         sumsq / ks->n / 2, pow2_max);
+}
+
+int main(int argc, char *argv[]) {
+  keyset_t *sets;
+  unsigned long n = 1000000, i;
+  int rounds = 5, nsets = 0, c, s;
+  const struct hash_entry *e;
+
+  while ((c = getopt(argc, argv, "n:r:")) != -1) {
+    switch (c) {
+    case 'n':
+      n = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      rounds = atoi(optarg);
+      break;
+    default:
+      printf("Usage: %s [-n KEYS] [-r ROUNDS] [TRACEFILE...]\n", argv[0]);
+      exit(0);
+    }
+  }
+
+  sets = calloc(argc - optind + 4, sizeof(keyset_t));
+  for (; optind < argc; optind++) {
+    if (load_trace(&sets[nsets], argv[optind]))
+      nsets++;
+  }
+  make_synthetic(&sets[nsets++], "seq", "key%lu", n);
+  make_synthetic(&sets[nsets++], "id12", "%012lu", n);
+  make_synthetic(&sets[nsets++], "prefix", "user:session:profile:%lu", n);
+  make_synthetic(&sets[nsets++], "long",
+                 "/var/cache/service/shard-0000/objects/by-id/%020lu.blob", n);
+
+  /* ns/key and MB/s: hashing speed. max/avg: chain lengths with one bucket
+     per key (avg counts non-empty chains, like print_ht_stats; uniform is
+     about 1.58). sq: mean squared chain size over the uniform expectation,
+     1.0 is ideal. pow2max: max chain when only the low bits pick the bucket. */
+  printf("%-14s %-6s %9s %9s %8s %8s %8s %9s\n",
+         "keys", "hash", "ns/key", "MB/s", "max", "avg", "sq", "pow2max");
+  for (s = 0; s < nsets; s++) {
+    for (e = hash_functions; e->name; e++)
+      bench(&sets[s], e, rounds);
+  }
+
+  for (s = 0; s < nsets; s++) {
+    for (i = 0; i < sets[s].n; i++)
+      free(sets[s].keys[i]);
+    free(sets[s].keys);
+    free(sets[s].lens);
+  }
+  free(sets);
+  return 0;
+}
+
+#pragma GCC diagnostic pop
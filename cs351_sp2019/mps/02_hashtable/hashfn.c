@@ -0,0 +1,253 @@
+#include "hashfn.h"
+#include "hashtable.h"
+#include <string.h>
+
+/* Daniel J. Bernstein's "times 33" string hash function, from comp.lang.C;
+   See https://groups.google.com/forum/#!topic/comp.lang.c/lSKWXiuNOAk */
+unsigned long hash(char *str) {
+
+  unsigned long hash = 5381;
+  int c;
+
+  while ((c = *str++))
+    hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+
+  return hash;
+}
+
+unsigned long hash_fnv1a(const void *key, unsigned long len, unsigned long seed) {
+
+  const unsigned char *p = key;
+  unsigned long hash = 0xcbf29ce484222325UL ^ seed;
+
+  while (len--) {
+    hash ^= *p++;
+    hash *= 0x100000001b3UL;
+  }
+  return hash;
+}
+
+// unaligned little-endian loads; memcpy compiles down to a plain mov
+static inline unsigned long rd64(const unsigned char *p) {
+  unsigned long v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline unsigned long rd32(const unsigned char *p) {
+  unsigned int v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static inline unsigned long rotl(unsigned long x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+/* Eight steps of hash * 33 + c folded into one per 64-bit load: the eight
+   multiplies by powers of 33 don't wait on each other the way eight chained
+   steps do. The result is the same as byte at a time. */
+#define D33_1 33UL
+#define D33_2 (D33_1 * 33)
+#define D33_3 (D33_2 * 33)
+#define D33_4 (D33_3 * 33)
+#define D33_5 (D33_4 * 33)
+#define D33_6 (D33_5 * 33)
+#define D33_7 (D33_6 * 33)
+#define D33_8 (D33_7 * 33)
+
+unsigned long hash_djb(const void *key, unsigned long len, unsigned long seed) {
+
+  const unsigned char *p = key;
+  unsigned long hash = 5381 ^ seed, w;
+
+  for (; len >= 8; len -= 8, p += 8) {
+    w = rd64(p);
+    hash = hash * D33_8 + (w & 0xff) * D33_7 + (w >> 8 & 0xff) * D33_6 +
+           (w >> 16 & 0xff) * D33_5 + (w >> 24 & 0xff) * D33_4 +
+           (w >> 32 & 0xff) * D33_3 + (w >> 40 & 0xff) * D33_2 +
+           (w >> 48 & 0xff) * D33_1 + (w >> 56);
+  }
+  while (len--)
+    hash = ((hash << 5) + hash) + *p++;
+
+  return hash;
+}
+
+/* wyhash (Wang Yi, public domain) core: multiply to 128 bits and fold the
+   halves together. Same structure as wyhash final4, not bit-compatible. */
+static inline unsigned long wy_mum(unsigned long a, unsigned long b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (unsigned long)r ^ (unsigned long)(r >> 64);
+}
+
+#define WY0 0xa0761d6478bd642fUL
+#define WY1 0xe7037ed1a0b428dbUL
+#define WY2 0x8ebc6af09c88c6e3UL
+#define WY3 0x589965cc75374cc3UL
+
+unsigned long hash_wy(const void *key, unsigned long len, unsigned long seed) {
+
+  const unsigned char *p = key;
+  unsigned long a, b, i = len;
+
+  seed ^= wy_mum(seed ^ WY0, WY1);
+  if (len <= 16) {
+    if (len >= 4) {
+      // two overlapping 4 byte reads from each end cover 4..16 bytes
+      a = (rd32(p) << 32) | rd32(p + ((len >> 3) << 2));
+      b = (rd32(p + len - 4) << 32) | rd32(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+      a = ((unsigned long)p[0] << 16) | ((unsigned long)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    if (i > 48) {
+      // three independent lanes so the multiplies overlap
+      unsigned long see1 = seed, see2 = seed;
+      do {
+        seed = wy_mum(rd64(p) ^ WY1, rd64(p + 8) ^ seed);
+        see1 = wy_mum(rd64(p + 16) ^ WY2, rd64(p + 24) ^ see1);
+        see2 = wy_mum(rd64(p + 32) ^ WY3, rd64(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = wy_mum(rd64(p) ^ WY1, rd64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    // last 16 bytes, overlapping what was already mixed
+    a = rd64(p + i - 16);
+    b = rd64(p + i - 8);
+  }
+  return wy_mum(wy_mum(a ^ WY1, b ^ seed) ^ WY0 ^ len, WY1);
+}
+
+/* xxHash64 by Yann Collet (BSD licensed reference algorithm). */
+#define XXP1 11400714785074694791UL
+#define XXP2 14029467366897019727UL
+#define XXP3 1609587929392839161UL
+#define XXP4 9650029242287828579UL
+#define XXP5 2870177450012600261UL
+
+static inline unsigned long xx_round(unsigned long acc, unsigned long in) {
+  return rotl(acc + in * XXP2, 31) * XXP1;
+}
+
+static inline unsigned long xx_merge(unsigned long h, unsigned long v) {
+  return (h ^ xx_round(0, v)) * XXP1 + XXP4;
+}
+
+unsigned long hash_xx64(const void *key, unsigned long len, unsigned long seed) {
+
+  const unsigned char *p = key;
+  const unsigned char *end = p + len;
+  unsigned long h;
+
+  if (len >= 32) {
+    unsigned long v1 = seed + XXP1 + XXP2, v2 = seed + XXP2;
+    unsigned long v3 = seed, v4 = seed - XXP1;
+    do {
+      v1 = xx_round(v1, rd64(p));
+      v2 = xx_round(v2, rd64(p + 8));
+      v3 = xx_round(v3, rd64(p + 16));
+      v4 = xx_round(v4, rd64(p + 24));
+      p += 32;
+    } while (p + 32 <= end);
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = xx_merge(h, v1);
+    h = xx_merge(h, v2);
+    h = xx_merge(h, v3);
+    h = xx_merge(h, v4);
+  } else {
+    h = seed + XXP5;
+  }
+  h += len;
+
+  for (; p + 8 <= end; p += 8)
+    h = rotl(h ^ xx_round(0, rd64(p)), 27) * XXP1 + XXP4;
+  if (p + 4 <= end) {
+    h = rotl(h ^ (rd32(p) * XXP1), 23) * XXP2 + XXP3;
+    p += 4;
+  }
+  while (p < end)
+    h = rotl(h ^ (*p++ * XXP5), 11) * XXP1;
+
+  // avalanche
+  h ^= h >> 33;
+  h *= XXP2;
+  h ^= h >> 29;
+  h *= XXP3;
+  h ^= h >> 32;
+  return h;
+}
+
+/* SipHash-2-4 (Aumasson & Bernstein), 64 bit output. */
+#define SIPROUND                                              \
+  do {                                                        \
+    v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32); \
+    v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;                    \
+    v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;                    \
+    v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32); \
+  } while (0)
+
+unsigned long hash_sip(const void *key, unsigned long len, unsigned long seed) {
+
+  const unsigned char *p = key;
+  const unsigned char *end = p + (len & ~7UL);
+  unsigned long k0 = seed, k1 = ~seed;
+  unsigned long v0 = k0 ^ 0x736f6d6570736575UL;
+  unsigned long v1 = k1 ^ 0x646f72616e646f6dUL;
+  unsigned long v2 = k0 ^ 0x6c7967656e657261UL;
+  unsigned long v3 = k1 ^ 0x7465646279746573UL;
+  unsigned long m, b = len << 56;
+  int i;
+
+  for (; p != end; p += 8) {
+    m = rd64(p);
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+  }
+
+  // last 0..7 bytes, with the length in the top byte
+  for (i = 0; i < (len & 7); i++)
+    b |= (unsigned long)p[i] << (8 * i);
+
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+const struct hash_entry hash_functions[] = {
+  { "djb", hash_djb },
+  { "fnv1a", hash_fnv1a },
+  { "wy", hash_wy },
+  { "xx64", hash_xx64 },
+  { "sip", hash_sip },
+  { NULL, NULL }
+};
+
+ht_hash_fn hash_by_name(const char *name) {
+
+  const struct hash_entry *e;
+  for (e = hash_functions; e->name; e++) {
+    if (strcmp(e->name, name) == 0)
+      return e->fn;
+  }
+  return NULL;
+}
@@ -0,0 +1,34 @@
+#ifndef HASHFN_T
+#define HASHFN_T
+
+/**
+ * Pluggable string hash functions. Every function hashes len bytes at key and
+ * mixes in seed; a table picks one through ht_opts_t.hash_fn / hash_seed.
+ */
+typedef unsigned long (*ht_hash_fn)(const void *key, unsigned long len,
+                                    unsigned long seed);
+
+/** Bernstein "times 33", eight bytes per step but equal to the byte at a
+    time loop. With seed 0 this equals hash() on ASCII strings. */
+unsigned long hash_djb(const void *key, unsigned long len, unsigned long seed);
+/** FNV-1a, byte at a time. */
+unsigned long hash_fnv1a(const void *key, unsigned long len, unsigned long seed);
+/** wyhash-style multiply/fold mixing, 8 (and 16/48) bytes at a time. */
+unsigned long hash_wy(const void *key, unsigned long len, unsigned long seed);
+/** xxHash64, 32 byte stripes. */
+unsigned long hash_xx64(const void *key, unsigned long len, unsigned long seed);
+/** SipHash-2-4 keyed with (seed, ~seed); use a secret seed for untrusted keys. */
+unsigned long hash_sip(const void *key, unsigned long len, unsigned long seed);
+
+/** Look up a hash function by name ("djb", "fnv1a", "wy", "xx64", "sip");
+    NULL if there is no such function. */
+ht_hash_fn hash_by_name(const char *name);
+
+/** Name/function pairs, terminated by a NULL name; handy for benchmarks. */
+struct hash_entry {
+  const char *name;
+  ht_hash_fn fn;
+};
+extern const struct hash_entry hash_functions[];
+
+#endif
@@ -2,29 +2,53 @@
 #include <string.h>
 #include "hashtable.h"
 
-/* Daniel J. Bernstein's "times 33" string hash function, from comp.lang.C;
-   See https://groups.google.com/forum/#!topic/comp.lang.c/lSKWXiuNOAk */
-unsigned long hash(char *str) {
-  unsigned long hash = 5381;
-  int c;
+hashtable_t *make_hashtable(unsigned long size) {
+  return NULL;
+}
+
+hashtable_t *make_hashtable_opts(unsigned long size, const ht_opts_t *opts) {
+  return make_hashtable(size);
+}
 
-  while ((c = *str++))
-    hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+char *ht_strdup(hashtable_t *ht, const char *s) {
+  return strdup(s);
+}
 
-  return hash;
+void ht_put(hashtable_t *ht, char *key, void *val) {
 }
 
-hashtable_t *make_hashtable(unsigned long size) {
+void ht_put_copy(hashtable_t *ht, const char *key, const void *val,
+                 unsigned long vlen) {
+}
+
+void ht_put_n(hashtable_t *ht, char *key, unsigned long len, void *val) {
+}
+
+void *ht_get_n(hashtable_t *ht, char *key, unsigned long len) {
   return NULL;
 }
 
-void ht_put(hashtable_t *ht, char *key, void *val) {
+void ht_del_n(hashtable_t *ht, char *key, unsigned long len) {
 }
 
 void *ht_get(hashtable_t *ht, char *key) {
   return NULL;
 }
 
+unsigned long ht_get_many(hashtable_t *ht, char **keys, unsigned long n,
+                          void **vals) {
+  return 0;
+}
+
+void ht_put_many(hashtable_t *ht, char **keys, void **vals, unsigned long n) {
+}
+
+unsigned long ht_scan(hashtable_t *ht, unsigned long cursor, unsigned long batch,
+                      ht_scan_out_t *out) {
+  out->n = 0;
+  return 0;
+}
+
 void ht_del(hashtable_t *ht, char *key) {
 }
 
@@ -34,5 +58,26 @@ void ht_iter(hashtable_t *ht, int (*f)(char *, void *)) {
 void ht_rehash(hashtable_t *ht, unsigned long newsize) {
 }
 
+void ht_stats(hashtable_t *ht, ht_stats_t *st) {
+  memset(st, 0, sizeof(ht_stats_t));
+}
+
+int ht_save(hashtable_t *ht, const char *path, unsigned long (*vlen)(void *val)) {
+  return 0;
+}
+
+hashtable_t *ht_load(const char *path, unsigned long size, const ht_opts_t *opts) {
+  return NULL;
+}
+
+int ht_bgsave(hashtable_t *ht, const char *path, unsigned long (*vlen)(void *val),
+              ht_bgsave_t *bg) {
+  return 0;
+}
+
+int ht_bgsave_done(ht_bgsave_t *bg, int wait) {
+  return 1;
+}
+
 void free_hashtable(hashtable_t *ht) {
 }
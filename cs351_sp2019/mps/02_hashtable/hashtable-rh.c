@@ -0,0 +1,252 @@
+/**
+  Open-addressing Robin Hood backend for the hashtable.h API. Built instead of
+  hashtable.c with -DHT_ROBINHOOD (see the hashtable-rh target in the Makefile).
+
+  Entries live directly in one slot array, so a lookup is a linear scan of
+  neighbouring slots rather than a walk over malloc'd nodes. On insert a
+  "poor" entry (long probe) steals the slot of a "rich" one (short probe),
+  which keeps probe lengths short and lets a miss stop early. Deletion uses
+  backward-shift instead of tombstones.
+*/
+
+#include "hashtable.h"
+#include <stdlib.h>
+#include <string.h>
+
+// grow once the table is this full (percent); probes get long past ~90%
+#define RH_MAX_LOAD 90
+
+// hash with the table's function; hash_djb (hash() on ASCII) by default
+static inline unsigned long rh_hash(hashtable_t *ht, char *key, unsigned long len) {
+  return ht->hashfn ? ht->hashfn(key, len, ht->seed) : hash_djb(key, len, 0);
+}
+
+// smallest slot count that keeps n entries under the max load
+static unsigned long rh_min_size(unsigned long n) {
+  return n * 100 / RH_MAX_LOAD + 1;
+}
+
+hashtable_t *make_hashtable(unsigned long size) {
+  return make_hashtable_opts(size, NULL);
+}
+
+// only the hash choice applies here: a rehash always moves every slot at once
+hashtable_t *make_hashtable_opts(unsigned long size, const ht_opts_t *opts) {
+
+  hashtable_t *ht = malloc(sizeof(hashtable_t));
+  ht->size = size ? size : 1;
+  ht->count = 0;
+  ht->slots = calloc(ht->size, sizeof(rh_slot_t));
+  ht->hashfn = opts ? opts->hash_fn : NULL;
+  ht->seed = opts ? opts->hash_seed : 0;
+  return ht;
+}
+
+// no arena here; keys and values are always the caller's heap copies
+char *ht_strdup(hashtable_t *ht, const char *s) {
+  return strdup(s);
+}
+
+// place an entry known not to be in the table (no key compares needed)
+static void rh_insert(hashtable_t *ht, unsigned long h, char *key,
+                      unsigned long klen, void *val) {
+
+  rh_slot_t cur = { h, key, val, 1, klen };
+  unsigned long idx = h % ht->size;
+
+  while (ht->slots[idx].psl) {
+    // richer resident gives up its slot, we carry it forward instead
+    if (ht->slots[idx].psl < cur.psl) {
+      rh_slot_t tmp = ht->slots[idx];
+      ht->slots[idx] = cur;
+      cur = tmp;
+    }
+    cur.psl++;
+    if (++idx == ht->size)
+      idx = 0;
+  }
+  ht->slots[idx] = cur;
+  ht->count++;
+}
+
+// index of the slot holding key, or -1 if absent
+static long rh_find(hashtable_t *ht, unsigned long h, char *key,
+                    unsigned long len) {
+
+  unsigned long idx = h % ht->size;
+  unsigned long psl = 1;
+
+  // once the resident is richer than we'd be, key can't be further along
+  while (ht->slots[idx].psl >= psl) {
+    if (ht->slots[idx].hash == h && ht->slots[idx].klen == len &&
+          memcmp(ht->slots[idx].key, key, len) == 0)
+      return idx;
+    psl++;
+    if (++idx == ht->size)
+      idx = 0;
+  }
+  return -1;
+}
+
+void ht_put(hashtable_t *ht, char *key, void *val) {
+  ht_put_n(ht, key, strlen(key), val);
+}
+
+void ht_put_n(hashtable_t *ht, char *key, unsigned long len, void *val) {
+
+  unsigned long h = rh_hash(ht, key, len);
+  long idx = rh_find(ht, h, key, len);
+
+  if (idx >= 0) {
+    // overwrite, same ownership rules as the chained table
+    free(ht->slots[idx].key);
+    free(ht->slots[idx].val);
+    ht->slots[idx].key = key;
+    ht->slots[idx].val = val;
+    return;
+  }
+
+  if (ht->count + 1 >= ht->size * RH_MAX_LOAD / 100)
+    ht_rehash(ht, ht->size * 2);
+  rh_insert(ht, h, key, len, val);
+}
+
+// separate copies; slots hold pointers, so there is nothing to inline into
+void ht_put_copy(hashtable_t *ht, const char *key, const void *val,
+                 unsigned long vlen) {
+  ht_put(ht, strdup(key), memcpy(malloc(vlen), val, vlen));
+}
+
+void *ht_get(hashtable_t *ht, char *key) {
+  return ht_get_n(ht, key, strlen(key));
+}
+
+void *ht_get_n(hashtable_t *ht, char *key, unsigned long len) {
+  long idx = rh_find(ht, rh_hash(ht, key, len), key, len);
+  return idx >= 0 ? ht->slots[idx].val : NULL;
+}
+
+// hash and prefetch the home slots of a group, then probe them
+#define RH_BATCH 16
+
+unsigned long ht_get_many(hashtable_t *ht, char **keys, unsigned long n,
+                          void **vals) {
+
+  unsigned long h[RH_BATCH], len[RH_BATCH], i, j, m, found = 0;
+  long idx;
+
+  for (i = 0; i < n; i += RH_BATCH) {
+    m = n - i < RH_BATCH ? n - i : RH_BATCH;
+    for (j = 0; j < m; j++) {
+      len[j] = strlen(keys[i + j]);
+      h[j] = rh_hash(ht, keys[i + j], len[j]);
+      __builtin_prefetch(&ht->slots[h[j] % ht->size]);
+    }
+    for (j = 0; j < m; j++) {
+      idx = rh_find(ht, h[j], keys[i + j], len[j]);
+      vals[i + j] = idx >= 0 ? ht->slots[idx].val : NULL;
+      found += idx >= 0;
+    }
+  }
+  return found;
+}
+
+// inserts can move every slot (growth), so there is nothing to stage
+void ht_put_many(hashtable_t *ht, char **keys, void **vals, unsigned long n) {
+  for (unsigned long i = 0; i < n; i++)
+    ht_put(ht, keys[i], vals[i]);
+}
+
+void ht_iter(hashtable_t *ht, int (*f)(char *, void *)) {
+
+  unsigned long i;
+  for (i = 0; i < ht->size; i++) {
+    if (ht->slots[i].psl && !f(ht->slots[i].key, ht->slots[i].val)) {
+      return; // abort iteration
+    }
+  }
+}
+
+// slots in index order; inserts and deletes move entries, so no promises then
+unsigned long ht_scan(hashtable_t *ht, unsigned long cursor, unsigned long batch,
+                      ht_scan_out_t *out) {
+
+  unsigned long i;
+  out->n = 0;
+  for (i = cursor; i < ht->size && (i == cursor || i - cursor < batch); i++) {
+    if (!(ht->slots[i].psl))
+      continue;
+    if (out->n == out->cap) {
+      out->cap = out->cap ? out->cap * 2 : 16;
+      out->entries = realloc(out->entries, out->cap * sizeof(ht_entry_t));
+    }
+    out->entries[out->n].key = ht->slots[i].key;
+    out->entries[out->n].val = ht->slots[i].val;
+    out->entries[out->n].klen = ht->slots[i].klen;
+    out->n++;
+  }
+  return i < ht->size ? i : 0;
+}
+
+void ht_del(hashtable_t *ht, char *key) {
+  ht_del_n(ht, key, strlen(key));
+}
+
+void ht_del_n(hashtable_t *ht, char *key, unsigned long len) {
+
+  long idx = rh_find(ht, rh_hash(ht, key, len), key, len);
+  unsigned long i, next;
+
+  if (idx < 0)
+    return;
+
+  free(ht->slots[idx].key);
+  free(ht->slots[idx].val);
+
+  // backward-shift: pull displaced followers one slot closer to home
+  i = idx;
+  next = i + 1 == ht->size ? 0 : i + 1;
+  while (ht->slots[next].psl > 1) {
+    ht->slots[i] = ht->slots[next];
+    ht->slots[i].psl--;
+    i = next;
+    next = i + 1 == ht->size ? 0 : i + 1;
+  }
+  memset(&ht->slots[i], 0, sizeof(rh_slot_t));
+  ht->count--;
+}
+
+void ht_rehash(hashtable_t *ht, unsigned long newsize) {
+
+  rh_slot_t *old = ht->slots;
+  unsigned long oldsize = ht->size;
+  unsigned long i;
+
+  // can't shrink below what the entries need
+  if (newsize < rh_min_size(ht->count))
+    newsize = rh_min_size(ht->count);
+
+  ht->slots = calloc(newsize, sizeof(rh_slot_t));
+  ht->size = newsize;
+  ht->count = 0;
+
+  // stored hashes mean moving entries never touches the key bytes
+  for (i = 0; i < oldsize; i++) {
+    if (old[i].psl)
+      rh_insert(ht, old[i].hash, old[i].key, old[i].klen, old[i].val);
+  }
+  free(old);
+}
+
+void free_hashtable(hashtable_t *ht) {
+
+  unsigned long i;
+  for (i = 0; i < ht->size; i++) {
+    if (ht->slots[i].psl) {
+      free(ht->slots[i].key);
+      free(ht->slots[i].val);
+    }
+  }
+  free(ht->slots);
+  free(ht);
+}
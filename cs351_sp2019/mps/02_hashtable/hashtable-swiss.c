@@ -0,0 +1,308 @@
+/**
+  Swiss-table style backend for the hashtable.h API. Built instead of
+  hashtable.c with -DHT_SWISS (see the hashtable-swiss target in the Makefile).
+
+  Every slot has a one byte control entry holding 7 bits of its hash. Control
+  bytes for a group of 16 slots sit in one 16 byte word, so a probe compares
+  all 16 fingerprints with a single SSE2 compare and only looks at slots whose
+  fingerprint matched. A group with an empty slot ends the probe, so a miss
+  usually costs one control word and no key compares at all.
+*/
+
+#include "hashtable.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// rebuild at 7/8 full, the usual Swiss table limit
+#define SW_MAX_LOAD(n) ((n) - (n) / 8)
+
+// hash with the table's function; hash_djb (hash() on ASCII) by default
+static inline unsigned long sw_hash(hashtable_t *ht, char *key, unsigned long len) {
+  return ht->hashfn ? ht->hashfn(key, len, ht->seed) : hash_djb(key, len, 0);
+}
+
+// bitmask of the slots in group g whose control byte equals c
+static unsigned int sw_match(hashtable_t *ht, unsigned long g, signed char c) {
+#ifdef __SSE2__
+  __m128i ctrl = _mm_load_si128((__m128i *)(ht->ctrl + g * SW_GROUP));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c)));
+#else
+  unsigned int i, mask = 0;
+  for (i = 0; i < SW_GROUP; i++) {
+    if (ht->ctrl[g * SW_GROUP + i] == c)
+      mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+// bitmask of the empty or deleted slots in group g (high bit of the control byte)
+static unsigned int sw_match_free(hashtable_t *ht, unsigned long g) {
+#ifdef __SSE2__
+  return _mm_movemask_epi8(_mm_load_si128((__m128i *)(ht->ctrl + g * SW_GROUP)));
+#else
+  unsigned int i, mask = 0;
+  for (i = 0; i < SW_GROUP; i++) {
+    if (ht->ctrl[g * SW_GROUP + i] < 0)
+      mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+// power of two slot count, at least one group, holding n entries under max load
+static unsigned long sw_size_for(unsigned long n) {
+  unsigned long size = SW_GROUP;
+  while (SW_MAX_LOAD(size) <= n)
+    size *= 2;
+  return size;
+}
+
+static void sw_alloc(hashtable_t *ht, unsigned long size) {
+  ht->size = size;
+  ht->count = 0;
+  ht->growth_left = SW_MAX_LOAD(size);
+  ht->ctrl = aligned_alloc(SW_GROUP, size);
+  memset(ht->ctrl, SW_EMPTY, size);
+  ht->slots = calloc(size, sizeof(sw_slot_t));
+}
+
+hashtable_t *make_hashtable(unsigned long size) {
+  return make_hashtable_opts(size, NULL);
+}
+
+// only the hash choice applies here: the table sizes itself
+hashtable_t *make_hashtable_opts(unsigned long size, const ht_opts_t *opts) {
+
+  hashtable_t *ht = malloc(sizeof(hashtable_t));
+  sw_alloc(ht, sw_size_for(size));
+  ht->hashfn = opts ? opts->hash_fn : NULL;
+  ht->seed = opts ? opts->hash_seed : 0;
+  return ht;
+}
+
+// no arena here; keys and values are always the caller's heap copies
+char *ht_strdup(hashtable_t *ht, const char *s) {
+  return strdup(s);
+}
+
+/* Probe groups in triangular steps (g, g+1, g+3, g+6, ...), which visits every
+   group when the group count is a power of two. */
+#define SW_FOREACH_GROUP(ht, h, g, i) \
+  for (g = SW_H1(h) & ((ht)->size / SW_GROUP - 1), i = 1; ; \
+       g = (g + i++) & ((ht)->size / SW_GROUP - 1))
+
+// index of the slot holding key, or -1 if absent
+static long sw_find(hashtable_t *ht, unsigned long h, char *key,
+                    unsigned long len) {
+
+  unsigned long g, i;
+  unsigned int match;
+
+  SW_FOREACH_GROUP(ht, h, g, i) {
+    match = sw_match(ht, g, SW_H2(h));
+    while (match) {
+      unsigned long idx = g * SW_GROUP + __builtin_ctz(match);
+      if (ht->slots[idx].hash == h && ht->slots[idx].klen == len &&
+          memcmp(ht->slots[idx].key, key, len) == 0)
+        return idx;
+      match &= match - 1;
+    }
+    // an empty slot means the key would have been placed by now
+    if (sw_match(ht, g, SW_EMPTY))
+      return -1;
+  }
+}
+
+// place an entry known not to be in the table; caller ensured growth_left
+static void sw_insert(hashtable_t *ht, unsigned long h, char *key,
+                      unsigned long klen, void *val) {
+
+  unsigned long g, i, idx;
+  unsigned int free_slots;
+
+  SW_FOREACH_GROUP(ht, h, g, i) {
+    free_slots = sw_match_free(ht, g);
+    if (free_slots) {
+      idx = g * SW_GROUP + __builtin_ctz(free_slots);
+      break;
+    }
+  }
+
+  // reusing a tombstone doesn't use up any growth
+  if (ht->ctrl[idx] == SW_EMPTY)
+    ht->growth_left--;
+  ht->ctrl[idx] = SW_H2(h);
+  ht->slots[idx].hash = h;
+  ht->slots[idx].key = key;
+  ht->slots[idx].val = val;
+  ht->slots[idx].klen = klen;
+  ht->count++;
+}
+
+void ht_put(hashtable_t *ht, char *key, void *val) {
+  ht_put_n(ht, key, strlen(key), val);
+}
+
+void ht_put_n(hashtable_t *ht, char *key, unsigned long len, void *val) {
+
+  unsigned long h = sw_hash(ht, key, len);
+  long idx = sw_find(ht, h, key, len);
+
+  if (idx >= 0) {
+    // overwrite, same ownership rules as the chained table
+    free(ht->slots[idx].key);
+    free(ht->slots[idx].val);
+    ht->slots[idx].key = key;
+    ht->slots[idx].val = val;
+    return;
+  }
+
+  // out of empty slots: rebuild, which also clears tombstones
+  if (ht->growth_left == 0)
+    ht_rehash(ht, sw_size_for(ht->count + 1));
+  sw_insert(ht, h, key, len, val);
+}
+
+// separate copies; slots hold pointers, so there is nothing to inline into
+void ht_put_copy(hashtable_t *ht, const char *key, const void *val,
+                 unsigned long vlen) {
+  ht_put(ht, strdup(key), memcpy(malloc(vlen), val, vlen));
+}
+
+void *ht_get(hashtable_t *ht, char *key) {
+  return ht_get_n(ht, key, strlen(key));
+}
+
+void *ht_get_n(hashtable_t *ht, char *key, unsigned long len) {
+  long idx = sw_find(ht, sw_hash(ht, key, len), key, len);
+  return idx >= 0 ? ht->slots[idx].val : NULL;
+}
+
+// hash and prefetch the first control group and its slots, then probe
+#define SW_BATCH 16
+
+unsigned long ht_get_many(hashtable_t *ht, char **keys, unsigned long n,
+                          void **vals) {
+
+  unsigned long h[SW_BATCH], len[SW_BATCH], i, j, m, g, found = 0;
+  long idx;
+
+  for (i = 0; i < n; i += SW_BATCH) {
+    m = n - i < SW_BATCH ? n - i : SW_BATCH;
+    for (j = 0; j < m; j++) {
+      len[j] = strlen(keys[i + j]);
+      h[j] = sw_hash(ht, keys[i + j], len[j]);
+      g = SW_H1(h[j]) & (ht->size / SW_GROUP - 1);
+      __builtin_prefetch(&ht->ctrl[g * SW_GROUP]);
+      __builtin_prefetch(&ht->slots[g * SW_GROUP]);
+    }
+    for (j = 0; j < m; j++) {
+      idx = sw_find(ht, h[j], keys[i + j], len[j]);
+      vals[i + j] = idx >= 0 ? ht->slots[idx].val : NULL;
+      found += idx >= 0;
+    }
+  }
+  return found;
+}
+
+// inserts can rebuild the table, so there is nothing to stage
+void ht_put_many(hashtable_t *ht, char **keys, void **vals, unsigned long n) {
+  for (unsigned long i = 0; i < n; i++)
+    ht_put(ht, keys[i], vals[i]);
+}
+
+void ht_iter(hashtable_t *ht, int (*f)(char *, void *)) {
+
+  unsigned long i;
+  for (i = 0; i < ht->size; i++) {
+    if (ht->ctrl[i] >= 0 && !f(ht->slots[i].key, ht->slots[i].val)) {
+      return; // abort iteration
+    }
+  }
+}
+
+// slots in index order; inserts and deletes move entries, so no promises then
+unsigned long ht_scan(hashtable_t *ht, unsigned long cursor, unsigned long batch,
+                      ht_scan_out_t *out) {
+
+  unsigned long i;
+  out->n = 0;
+  for (i = cursor; i < ht->size && (i == cursor || i - cursor < batch); i++) {
+    if (!(ht->ctrl[i] >= 0))
+      continue;
+    if (out->n == out->cap) {
+      out->cap = out->cap ? out->cap * 2 : 16;
+      out->entries = realloc(out->entries, out->cap * sizeof(ht_entry_t));
+    }
+    out->entries[out->n].key = ht->slots[i].key;
+    out->entries[out->n].val = ht->slots[i].val;
+    out->entries[out->n].klen = ht->slots[i].klen;
+    out->n++;
+  }
+  return i < ht->size ? i : 0;
+}
+
+void ht_del(hashtable_t *ht, char *key) {
+  ht_del_n(ht, key, strlen(key));
+}
+
+void ht_del_n(hashtable_t *ht, char *key, unsigned long len) {
+
+  long idx = sw_find(ht, sw_hash(ht, key, len), key, len);
+
+  if (idx < 0)
+    return;
+
+  free(ht->slots[idx].key);
+  free(ht->slots[idx].val);
+  memset(&ht->slots[idx], 0, sizeof(sw_slot_t));
+  ht->count--;
+
+  // probes stop at a group that still has an empty slot, so no probe ever
+  // went past this one; it can go back to empty instead of a tombstone
+  if (sw_match(ht, idx / SW_GROUP, SW_EMPTY)) {
+    ht->ctrl[idx] = SW_EMPTY;
+    ht->growth_left++;
+  } else {
+    ht->ctrl[idx] = SW_DELETED;
+  }
+}
+
+void ht_rehash(hashtable_t *ht, unsigned long newsize) {
+
+  signed char *oldctrl = ht->ctrl;
+  sw_slot_t *old = ht->slots;
+  unsigned long oldsize = ht->size;
+  unsigned long i;
+
+  // power of two groups, never below what the entries need
+  if (newsize < ht->count)
+    newsize = ht->count;
+  sw_alloc(ht, sw_size_for(newsize));
+
+  // stored hashes mean moving entries never touches the key bytes
+  for (i = 0; i < oldsize; i++) {
+    if (oldctrl[i] >= 0)
+      sw_insert(ht, old[i].hash, old[i].key, old[i].klen, old[i].val);
+  }
+  free(oldctrl);
+  free(old);
+}
+
+void free_hashtable(hashtable_t *ht) {
+
+  unsigned long i;
+  for (i = 0; i < ht->size; i++) {
+    if (ht->ctrl[i] >= 0) {
+      free(ht->slots[i].key);
+      free(ht->slots[i].val);
+    }
+  }
+  free(ht->ctrl);
+  free(ht->slots);
+  free(ht);
+}
@@ -1,104 +1,1356 @@
 #include "hashtable.h"
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef HT_THREADSAFE
+#include "epoch.h"
+#else
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "frozen.h"
+#endif
 
-/* Daniel J. Bernstein's "times 33" string hash function, from comp.lang.C;
-   See https://groups.google.com/forum/#!topic/comp.lang.c/lSKWXiuNOAk */
-unsigned long hash(char *str) {
+/* Thread-safe builds (-DHT_THREADSAFE) lock one stripe per chain touched.
+   Everything that moves chains around (rehash, migration, auto resize) takes
+   every stripe, so holding any one stripe keeps the bucket arrays stable.
+   ht_get takes no lock at all: links are published with HT_WRITE (release)
+   and followed with HT_READ (acquire), unlinked nodes and arrays go through
+   HT_RETIRE (epoch.h) rather than free, and chain moves bump ht->seq like a
+   seqlock so a reader that raced one retries under the stripe lock.
+   In the plain build all of this compiles away. */
+#ifdef HT_THREADSAFE
+#define HT_READ(x)      __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define HT_WRITE(x, v)  __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define HT_RETIRE(p, fn) epoch_retire(p, fn)
+#define HT_ADD(x, n)    __atomic_add_fetch(&(x), (n), __ATOMIC_RELAXED)
+#define HT_STRIPE(ht, head) \
+  (&(ht)->stripes[((unsigned long)(head) / sizeof(bucket_t *)) % (ht)->nstripes].lock)
+#define HT_UNLOCK(ht, head) pthread_mutex_unlock(HT_STRIPE(ht, head))
+#else
+#define HT_READ(x)      (x)
+#define HT_WRITE(x, v)  ((x) = (v))
+#define HT_RETIRE(p, fn) fn(p)
+#define HT_ADD(x, n)    ((x) += (n))
+#define HT_UNLOCK(ht, head)
+#endif
 
-  unsigned long hash = 5381;
+// hash with the table's function; hash_djb (hash() on ASCII) by default
+static inline unsigned long ht_hash(hashtable_t *ht, char *key, unsigned long len) {
+  return ht->hashfn ? ht->hashfn(key, len, ht->seed) : hash_djb(key, len, 0);
+}
+
+// node b holds the n bytes at k (h is their hash)
+#define HT_MATCH(b, h, k, n) \
+  ((b)->hash == (h) && (b)->klen == (n) && memcmp((b)->key, (k), (n)) == 0)
+
+// cache mode only exists outside thread-safe builds
+#ifdef HT_THREADSAFE
+#define HT_CACHE(ht) 0
+#else
+#define HT_CACHE(ht) ((ht)->cache)
+#endif
+
+// histogram slot for a chain of, or a probe over, n nodes
+static inline unsigned long ht_stat_slot(unsigned long n) {
+  return n < HT_STAT_LENS ? n : HT_STAT_LENS - 1;
+}
+
+// keep chains[] current: some chain went from `from` entries to `to`
+static inline void ht_chain_changed(hashtable_t *ht, unsigned long from,
+                                    unsigned long to) {
+  if (from)
+    HT_ADD(ht->chains[ht_stat_slot(from)], -1);
+  if (to)
+    HT_ADD(ht->chains[ht_stat_slot(to)], 1);
+}
+
+// a get or put compared n nodes
+static inline void ht_probed(hashtable_t *ht, unsigned long n) {
+  if (ht->probe_stats)
+    HT_ADD(ht->probes[ht_stat_slot(n)], 1);
+}
+
+static unsigned long ht_chain_length(bucket_t *b) {
+  unsigned long n = 0;
+  for (; b; b = b->next)
+    n++;
+  return n;
+}
+
+// take / drop every stripe, always in index order
+static void ht_lock_all(hashtable_t *ht) {
+#ifdef HT_THREADSAFE
+  for (unsigned long i = 0; i < ht->nstripes; i++)
+    pthread_mutex_lock(&ht->stripes[i].lock);
+#endif
+}
+
+static void ht_unlock_all(hashtable_t *ht) {
+#ifdef HT_THREADSAFE
+  for (unsigned long i = ht->nstripes; i-- > 0; )
+    pthread_mutex_unlock(&ht->stripes[i].lock);
+#endif
+}
+
+// chains are about to move between arrays: make seq odd, then even again
+static void ht_seq_begin(hashtable_t *ht) {
+#ifdef HT_THREADSAFE
+  __atomic_store_n(&ht->seq, ht->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+#endif
+}
+
+static void ht_seq_end(hashtable_t *ht) {
+#ifdef HT_THREADSAFE
+  __atomic_store_n(&ht->seq, ht->seq + 1, __ATOMIC_RELEASE);
+#endif
+}
+
+#ifdef HT_THREADSAFE
+// reader side: slots picked between these two are safe to dereference
+// (inside an epoch) only if ht_seq_check returns true
+static unsigned long ht_seq_read(hashtable_t *ht) {
+  return __atomic_load_n(&ht->seq, __ATOMIC_ACQUIRE);
+}
+
+static int ht_seq_check(hashtable_t *ht, unsigned long seq) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return !(seq & 1) && __atomic_load_n(&ht->seq, __ATOMIC_RELAXED) == seq;
+}
+#endif
+
+#ifdef HT_THREADSAFE
+// free_bucket with the signature HT_RETIRE wants
+static void ht_free_node(void *b) {
+  free_bucket(b);
+}
+#endif
+
+static bucket_t *ht_node(hashtable_t *ht) {
+#ifdef HT_THREADSAFE
+  return malloc(sizeof(bucket_t));
+#else
+  return slab_alloc(&ht->nodes);
+#endif
+}
+
+// ht_put_copy nodes carry key and value in the same block, key first
+#define HT_INLINE(b) ((b)->key == (char *)((b) + 1))
+
+// variable-size block for an inline node: heap, or the arena if there is one
+static bucket_t *ht_inline_node(hashtable_t *ht, unsigned long size) {
+#ifndef HT_THREADSAFE
+  if (ht->use_arena)
+    return arena_alloc(&ht->arena, size);
+#endif
+  return malloc(size);
+}
+
+#ifndef HT_THREADSAFE
+/* Cache mode (opts.cache_entries/cache_bytes). Every node sits in the
+   clock ring, in no particular order: a node leaving the table hands its
+   slot to the ring's last one. A get sets the node's HT_REF bit; to evict,
+   the hand clears set bits and moves on until it finds a node without one.
+   Finding the victim and unlinking it from its chain touch no other
+   bucket, so eviction is O(1) plus one chain walk, like ht_del. */
+
+// default cache_cost: node, key and value as a C string
+static unsigned long ht_cost_str(char *key, unsigned long klen, void *val) {
+  return sizeof(bucket_t) + klen + 1 + (val ? strlen(val) + 1 : 0);
+}
+
+static unsigned long ht_cost(hashtable_t *ht, bucket_t *b) {
+  return ht->cache_cost(b->key, b->klen, b->val);
+}
+
+static void ht_clock_add(hashtable_t *ht, bucket_t *b) {
+  if (ht->clock_n == ht->clock_cap) {
+    ht->clock_cap = ht->clock_cap ? ht->clock_cap * 2 : 64;
+    ht->clock = realloc(ht->clock, ht->clock_cap * sizeof(bucket_t *));
+  }
+  ht->clock[ht->clock_n++] = b;
+  b->clock = ht->clock_n;
+  ht->bytes += ht_cost(ht, b);
+}
+
+static void ht_clock_remove(hashtable_t *ht, bucket_t *b) {
+  unsigned long i = (b->clock & HT_SLOT) - 1;
+  bucket_t *last = ht->clock[--ht->clock_n];
+
+  ht->clock[i] = last;
+  last->clock = (last->clock & HT_REF) | (i + 1);
+  b->clock = 0;
+  if (ht->clock_hand >= ht->clock_n)
+    ht->clock_hand = 0;
+}
+
+// nb replaces b in the table: it takes over b's slot, already referenced
+static void ht_clock_replace(hashtable_t *ht, bucket_t *b, bucket_t *nb) {
+  nb->clock = (b->clock & HT_SLOT) | HT_REF;
+  ht->clock[(b->clock & HT_SLOT) - 1] = nb;
+  b->clock = 0;
+  ht->bytes += ht_cost(ht, nb);
+}
+#endif
+
+#ifndef HT_THREADSAFE
+/* Counting Bloom filter (opts.bloom_counters). A key's hash picks one
+   HT_BLOOM_BLOCK-byte block of 4-bit counters and HT_BLOOM_K counters in
+   it, so a test reads one cache line. Counters stick at 15: once one has
+   overflowed there is no telling how far it should come back down. The
+   hashes come from the nodes, so the filter is rebuilt without touching a
+   key: all at once by an all-at-once rehash, bucket by bucket along with
+   an incremental one (next_bloom). */
+#define HT_BLOOM_K 4
+
+static unsigned long ht_bloom_mix(unsigned long h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdUL;
+  return h ^ h >> 33;
+}
+
+// blocks for a bucket array of size, at least one
+static unsigned long ht_bloom_size(hashtable_t *ht, unsigned long size) {
+  unsigned long bytes = size * ht->bloom_counters / 2;
+  return bytes > HT_BLOOM_BLOCK ? (bytes + HT_BLOOM_BLOCK - 1) / HT_BLOOM_BLOCK : 1;
+}
+
+static unsigned char *ht_bloom_alloc(unsigned long blocks) {
+  unsigned char *f = aligned_alloc(HT_BLOOM_BLOCK, blocks * HT_BLOOM_BLOCK);
+  return memset(f, 0, blocks * HT_BLOOM_BLOCK);
+}
+
+// the block for x (a mixed hash); counter i is the nibble at bits 7i of x
+static inline unsigned char *ht_bloom_block(unsigned char *f, unsigned long blocks,
+                                            unsigned long x) {
+  return f + ((x >> 32) * blocks >> 32) * HT_BLOOM_BLOCK;
+}
+
+// count h in (up) or out of the filter
+static void ht_bloom_update(unsigned char *f, unsigned long blocks,
+                            unsigned long h, int up) {
+  unsigned long x = ht_bloom_mix(h);
+  unsigned char *blk = ht_bloom_block(f, blocks, x);
+
+  for (int i = 0; i < HT_BLOOM_K; i++) {
+    unsigned int c = x >> (7 * i) & 127, shift = (c & 1) * 4;
+    unsigned int v = blk[c >> 1] >> shift & 15;
+    if (v == 15 || (!up && v == 0))
+      continue;
+    if (up)
+      blk[c >> 1] += 1 << shift;
+    else
+      blk[c >> 1] -= 1 << shift;
+  }
+}
+
+// 0 if h was certainly never counted in
+static int ht_bloom_test(unsigned char *f, unsigned long blocks, unsigned long h) {
+  unsigned long x = ht_bloom_mix(h);
+  unsigned char *blk = ht_bloom_block(f, blocks, x);
+
+  for (int i = 0; i < HT_BLOOM_K; i++) {
+    unsigned int c = x >> (7 * i) & 127;
+    if (!(blk[c >> 1] >> (c & 1) * 4 & 15))
+      return 0;
+  }
+  return 1;
+}
+
+// true if h's chain is in the live array (always, outside a migration)
+static int ht_migrated(hashtable_t *ht, unsigned long h) {
+  return !ht->old_buckets || h % ht->old_size < ht->migrate_idx;
+}
+
+// a node with hash h went into (up) or out of the table
+static void ht_bloom_note(hashtable_t *ht, unsigned long h, int up) {
+  if (!ht->bloom)
+    return;
+  ht_bloom_update(ht->bloom, ht->bloom_blocks, h, up);
+  // next_bloom only has the chains already moved
+  if (ht->next_bloom && ht_migrated(ht, h))
+    ht_bloom_update(ht->next_bloom, ht->next_bloom_blocks, h, up);
+}
+#endif
+
+#ifndef HT_THREADSAFE
+/* Tree bins. A chain longer than HT_TREEIFY gets an AVL tree over its
+   nodes, ordered by (hash, key length, key bytes), so gets, puts and
+   deletes on it compare O(log n) keys however badly the keys collide. The
+   chain itself stays a list, kept in tree order: a node is linked right
+   behind its in-order predecessor, found on the way down the tree. So
+   iteration, ht_scan, rehashing and freeing walk it like any other chain.
+   Once a tree bin is down to HT_UNTREEIFY entries it is a plain list again. */
+#define HT_TREEIFY   8
+#define HT_UNTREEIFY 6
+
+typedef struct ht_tnode {
+  bucket_t *b;
+  struct ht_tnode *left, *right;
+  int height;
+} ht_tnode_t;
+
+struct ht_tree {
+  ht_tnode_t *root;
+  unsigned long n;  // entries, the chain's length
+};
+
+// order of the len bytes at key (hash h) against node b
+static int ht_tree_cmp(unsigned long h, char *key, unsigned long len, bucket_t *b) {
+  if (h != b->hash)
+    return h < b->hash ? -1 : 1;
+  if (len != b->klen)
+    return len < b->klen ? -1 : 1;
+  return memcmp(key, b->key, len);
+}
+
+static int ht_tn_height(ht_tnode_t *t) {
+  return t ? t->height : 0;
+}
+
+static void ht_tn_fix(ht_tnode_t *t) {
+  int l = ht_tn_height(t->left), r = ht_tn_height(t->right);
+  t->height = (l > r ? l : r) + 1;
+}
+
+static ht_tnode_t *ht_tn_rotr(ht_tnode_t *t) {
+  ht_tnode_t *l = t->left;
+  t->left = l->right;
+  l->right = t;
+  ht_tn_fix(t);
+  ht_tn_fix(l);
+  return l;
+}
+
+static ht_tnode_t *ht_tn_rotl(ht_tnode_t *t) {
+  ht_tnode_t *r = t->right;
+  t->right = r->left;
+  r->left = t;
+  ht_tn_fix(t);
+  ht_tn_fix(r);
+  return r;
+}
+
+static ht_tnode_t *ht_tn_balance(ht_tnode_t *t) {
+  int d = ht_tn_height(t->left) - ht_tn_height(t->right);
+  if (d > 1) {
+    if (ht_tn_height(t->left->left) < ht_tn_height(t->left->right))
+      t->left = ht_tn_rotl(t->left);
+    return ht_tn_rotr(t);
+  }
+  if (d < -1) {
+    if (ht_tn_height(t->right->right) < ht_tn_height(t->right->left))
+      t->right = ht_tn_rotr(t->right);
+    return ht_tn_rotl(t);
+  }
+  ht_tn_fix(t);
+  return t;
+}
+
+static ht_tnode_t *ht_tn_insert(ht_tnode_t *t, ht_tnode_t *n) {
+  if (!t)
+    return n;
+  if (ht_tree_cmp(n->b->hash, n->b->key, n->b->klen, t->b) < 0)
+    t->left = ht_tn_insert(t->left, n);
+  else
+    t->right = ht_tn_insert(t->right, n);
+  return ht_tn_balance(t);
+}
+
+static ht_tnode_t *ht_tn_remove_min(ht_tnode_t *t, ht_tnode_t **min) {
+  if (!t->left) {
+    *min = t;
+    return t->right;
+  }
+  t->left = ht_tn_remove_min(t->left, min);
+  return ht_tn_balance(t);
+}
+
+// take the tree node of b out of t, into *out
+static ht_tnode_t *ht_tn_remove(ht_tnode_t *t, bucket_t *b, ht_tnode_t **out) {
+  int c = ht_tree_cmp(b->hash, b->key, b->klen, t->b);
+  if (c < 0) {
+    t->left = ht_tn_remove(t->left, b, out);
+  } else if (c > 0) {
+    t->right = ht_tn_remove(t->right, b, out);
+  } else {
+    ht_tnode_t *m;
+    *out = t;
+    if (!t->left || !t->right)
+      return t->left ? t->left : t->right;
+    // the successor takes t's place
+    t->right = ht_tn_remove_min(t->right, &m);
+    m->left = t->left;
+    m->right = t->right;
+    t = m;
+  }
+  return ht_tn_balance(t);
+}
+
+static void ht_tn_free(ht_tnode_t *t) {
+  if (!t)
+    return;
+  ht_tn_free(t->left);
+  ht_tn_free(t->right);
+  free(t);
+}
+
+// link the nodes of t into a list in order, from *link on
+static void ht_tn_relink(ht_tnode_t *t, bucket_t ***link) {
+  if (!t)
+    return;
+  ht_tn_relink(t->left, link);
+  **link = t->b;
+  *link = &t->b->next;
+  ht_tn_relink(t->right, link);
+}
+
+/* Look key up in tree t, whose chain starts at *head. Returns its tree
+   node or NULL; either way *link is then the link to the key's node, or
+   the link a node for it goes in to keep the chain in order. *probes
+   counts the nodes compared. */
+static ht_tnode_t *ht_tree_seek(ht_tree_t *t, bucket_t **head, unsigned long h,
+                                char *key, unsigned long len, bucket_t ***link,
+                                unsigned long *probes) {
+  ht_tnode_t *tn = t->root, *pred = NULL;
   int c;
 
-  while ((c = *str++))
-    hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+  *probes = 0;
+  while (tn) {
+    ++*probes;
+    if ((c = ht_tree_cmp(h, key, len, tn->b)) == 0)
+      break;
+    if (c > 0) {
+      pred = tn;
+      tn = tn->right;
+    } else {
+      tn = tn->left;
+    }
+  }
+  // a found node's predecessor is the largest one on its left, if any
+  if (tn && tn->left) {
+    for (pred = tn->left; pred->right; pred = pred->right)
+      ;
+  }
+  *link = pred ? &pred->b->next : head;
+  return tn;
+}
+
+// the trees[] (or old_trees[]) slot of the chain at head; NULL if that
+// array has no trees yet, unless make
+static ht_tree_t **ht_tree_slot(hashtable_t *ht, bucket_t **head, int make) {
+  ht_tree_t ***trees = &ht->trees;
+  unsigned long i = head - ht->buckets, n = ht->size;
+
+  if (!(head >= ht->buckets && i < ht->size)) {
+    trees = &ht->old_trees;
+    i = head - ht->old_buckets;
+    n = ht->old_size;
+  }
+  if (!*trees) {
+    if (!make)
+      return NULL;
+    *trees = calloc(n, sizeof(ht_tree_t *));
+  }
+  return &(*trees)[i];
+}
+
+static ht_tree_t *ht_tree_of(hashtable_t *ht, bucket_t **head) {
+  ht_tree_t **slot = ht_tree_slot(ht, head, 0);
+  return slot ? *slot : NULL;
+}
+
+static void ht_tree_add(ht_tree_t *t, bucket_t *b) {
+  ht_tnode_t *tn = malloc(sizeof(ht_tnode_t));
+  tn->b = b;
+  tn->left = tn->right = NULL;
+  tn->height = 1;
+  t->root = ht_tn_insert(t->root, tn);
+  t->n++;
+}
+
+// give the chain at head a tree, relinking it in tree order
+static void ht_treeify(hashtable_t *ht, bucket_t **head) {
+  ht_tree_t *t = calloc(1, sizeof(ht_tree_t));
+  bucket_t **link = head;
+
+  for (bucket_t *b = *head; b; b = b->next)
+    ht_tree_add(t, b);
+  ht_tn_relink(t->root, &link);
+  *link = NULL;
+  *ht_tree_slot(ht, head, 1) = t;
+  ht->ntrees++;
+}
+
+// the chain keeps its nodes, only the tree goes
+static void ht_untreeify(hashtable_t *ht, ht_tree_t **slot) {
+  ht_tn_free((*slot)->root);
+  free(*slot);
+  *slot = NULL;
+  ht->ntrees--;
+}
+
+// b (already unlinked) leaves the tree at slot
+static void ht_tree_del(hashtable_t *ht, ht_tree_t **slot, bucket_t *b) {
+  ht_tnode_t *tn;
+  (*slot)->root = ht_tn_remove((*slot)->root, b, &tn);
+  free(tn);
+  if (--(*slot)->n <= HT_UNTREEIFY)
+    ht_untreeify(ht, slot);
+}
+
+static void ht_free_trees(hashtable_t *ht, ht_tree_t **trees, unsigned long size) {
+  if (!trees)
+    return;
+  for (unsigned long i = 0; i < size; i++) {
+    if (trees[i])
+      ht_untreeify(ht, &trees[i]);
+  }
+  free(trees);
+}
+#endif
+
+#ifndef HT_THREADSAFE
+/* Snapshot tables (ht_load). A key is in the chains, in snap, or in
+   neither, never live in both: a put of a new key or a delete that found
+   nothing in the chains retires the key's snap entry, if it has one. */
+
+// snap slot of the key if it is live there, else -1
+static long ht_snap_find(hashtable_t *ht, char *key, unsigned long len) {
+  long s;
 
-  return hash;
+  if (!ht->snap || ht->snap_live == 0)
+    return -1;
+  s = fz_find_n(ht->snap, key, len);
+  if (s >= 0 && ht->snap_gone[s / 64] & 1UL << s % 64)
+    return -1;
+  return s;
+}
+
+static void *ht_snap_get(hashtable_t *ht, char *key, unsigned long len) {
+  long s = ht_snap_find(ht, key, len);
+  return s < 0 ? NULL : fz_at(ht->snap, s, NULL, NULL);
+}
+
+static void ht_snap_retire(hashtable_t *ht, char *key, unsigned long len) {
+  long s = ht_snap_find(ht, key, len);
+  if (s >= 0) {
+    ht->snap_gone[s / 64] |= 1UL << s % 64;
+    ht->snap_live--;
+  }
+}
+#endif
+
+// give back a node that is out of the table, with its key and value
+static void ht_drop(hashtable_t *ht, bucket_t *b) {
+#ifdef HT_THREADSAFE
+  HT_RETIRE(b, ht_free_node);
+#else
+  if (ht->cache) {
+    ht->bytes -= ht_cost(ht, b);
+    if (b->clock)
+      ht_clock_remove(ht, b);
+  }
+  if (HT_INLINE(b)) {
+    if (!ht->use_arena)
+      free(b);
+    return;
+  }
+  if (!ht->use_arena) {
+    free(b->key);
+    free(b->val);
+  }
+  slab_free(&ht->nodes, b);
+#endif
+}
+
+char *ht_strdup(hashtable_t *ht, const char *s) {
+#ifndef HT_THREADSAFE
+  if (ht->use_arena)
+    return arena_strdup(&ht->arena, s);
+#endif
+  return strdup(s);
 }
 
 hashtable_t *make_hashtable(unsigned long size) {
+  return make_hashtable_opts(size, NULL);
+}
+
+hashtable_t *make_hashtable_opts(unsigned long size, const ht_opts_t *opts) {
+
+  hashtable_t *ht;
 
-  hashtable_t *ht = malloc(sizeof(hashtable_t));
+  // an arena gives nothing back before free_hashtable: evictions would
+  // leave the cache's memory growing all the same
+  if (opts && opts->arena && (opts->cache_entries || opts->cache_bytes))
+    return NULL;
+  ht = calloc(1, sizeof(hashtable_t));
   ht->size = size;
   ht->buckets = calloc(sizeof(bucket_t *), size);
+  if (opts) {
+    ht->rehash_steps = opts->rehash_steps;
+    ht->max_load = opts->max_load;
+    ht->min_load = opts->min_load;
+    ht->hashfn = opts->hash_fn;
+    ht->seed = opts->hash_seed;
+    ht->rehash_threads = opts->rehash_threads;
+    ht->probe_stats = opts->probe_stats;
+  }
+#ifdef HT_THREADSAFE
+  ht->nstripes = opts && opts->lock_stripes ? opts->lock_stripes : HT_STRIPES;
+  ht->stripes = aligned_alloc(sizeof(ht_stripe_t), ht->nstripes * sizeof(ht_stripe_t));
+  for (unsigned long i = 0; i < ht->nstripes; i++)
+    pthread_mutex_init(&ht->stripes[i].lock, NULL);
+#else
+  slab_init(&ht->nodes, sizeof(bucket_t));
+  arena_init(&ht->arena);
+  ht->use_arena = opts && opts->arena;
+  if (opts && (opts->cache_entries || opts->cache_bytes)) {
+    ht->cache = 1;
+    ht->cache_entries = opts->cache_entries;
+    ht->cache_bytes = opts->cache_bytes;
+    ht->cache_cost = opts->cache_cost ? opts->cache_cost : ht_cost_str;
+  }
+  if (opts && opts->bloom_counters) {
+    ht->bloom_counters = opts->bloom_counters;
+    ht->bloom_blocks = ht_bloom_size(ht, size);
+    ht->bloom = ht_bloom_alloc(ht->bloom_blocks);
+  }
+#endif
   return ht;
 }
 
-void ht_put(hashtable_t *ht, char *key, void *val) {
+// move a bounded number of old buckets into the live array (incremental rehash)
+static void ht_migrate(hashtable_t *ht, unsigned long steps) {
 
-  // hash to bucket sizes, check the bucket for key match
-  unsigned int idx = hash(key) % ht->size;
-  bucket_t *b = ht->buckets[idx];
-  while (b) {
-    if (strcmp(b->key, key) == 0) {
-      // overwrite the val for the bucket on match and return 
-      // free to open up space, that was used, then replace it. (next is primitive addr)
-      free(b->val);
-      free(b->key);
-      b->key = key;
-      b->val = val;
+  while (steps-- && ht->migrate_idx < ht->old_size) {
+    bucket_t *b = ht->old_buckets[ht->migrate_idx];
+    unsigned long len = 0, nlen;
+    while (b) {
+      unsigned int nidx = b->hash % ht->size;
+      bucket_t *nextb = b->next;
+      bucket_t **nhead = &ht->buckets[nidx], **link = nhead;
+#ifndef HT_THREADSAFE
+      // into a tree bin: at its place in the order
+      ht_tree_t *tree = ht->trees ? ht->trees[nidx] : NULL;
+      unsigned long probes;
+      if (tree) {
+        ht_tree_seek(tree, nhead, b->hash, b->key, b->klen, &link, &probes);
+        nlen = tree->n;
+      } else
+#endif
+      nlen = ht_chain_length(*nhead);
+      ht_chain_changed(ht, nlen, nlen + 1);
+#ifndef HT_THREADSAFE
+      if (ht->next_bloom)
+        ht_bloom_update(ht->next_bloom, ht->next_bloom_blocks, b->hash, 1);
+#endif
+      HT_WRITE(b->next, *link);
+      HT_WRITE(*link, b);
+#ifndef HT_THREADSAFE
+      if (tree)
+        ht_tree_add(tree, b);
+      else if (nlen + 1 > HT_TREEIFY)
+        ht_treeify(ht, nhead);
+#endif
+      b = nextb;
+      len++;
+    }
+    ht_chain_changed(ht, len, 0);
+#ifndef HT_THREADSAFE
+    // its nodes are all in the new array now
+    if (ht->old_trees && ht->old_trees[ht->migrate_idx])
+      ht_untreeify(ht, &ht->old_trees[ht->migrate_idx]);
+#endif
+    HT_WRITE(ht->old_buckets[ht->migrate_idx], NULL);
+    HT_WRITE(ht->migrate_idx, ht->migrate_idx + 1);
+  }
 
-      return;
+  // fully drained, drop the old array
+  if (ht->migrate_idx == ht->old_size) {
+#ifndef HT_THREADSAFE
+    // and the filter for it, next_bloom now has every key
+    if (ht->next_bloom) {
+      free(ht->bloom);
+      ht->bloom = ht->next_bloom;
+      ht->bloom_blocks = ht->next_bloom_blocks;
+      ht->next_bloom = NULL;
     }
+    ht_free_trees(ht, ht->old_trees, ht->old_size);
+    ht->old_trees = NULL;
+#endif
+    HT_RETIRE(ht->old_buckets, free);
+    HT_WRITE(ht->old_buckets, NULL);
+    HT_WRITE(ht->old_size, 0);
+    HT_WRITE(ht->migrate_idx, 0);
+  }
+}
 
-    // no match, go next in LList
-    b = b->next;
+// do this operation's share of a pending incremental rehash
+static void ht_step(hashtable_t *ht) {
+
+  if (HT_READ(ht->old_buckets)) {
+    ht_lock_all(ht);
+    if (ht->old_buckets) {
+      ht_seq_begin(ht);
+      ht_migrate(ht, ht->rehash_steps);
+      ht_seq_end(ht);
+    }
+    ht_unlock_all(ht);
+  }
+}
+
+static void ht_resize(hashtable_t *ht, unsigned long newsize);
+
+// grow by load factor after an insert, if the table was made with thresholds
+static void ht_autogrow(hashtable_t *ht) {
+
+  // during a migration size is the new array; judge load against that
+  if (ht->max_load > 0 && HT_READ(ht->count) > ht->max_load * HT_READ(ht->size)) {
+    ht_lock_all(ht);
+    // another thread may have grown it while we waited
+    if (ht->count > ht->max_load * ht->size) {
+      ht->grow_count++;
+      ht_resize(ht, ht->size * 2);
+    }
+    ht_unlock_all(ht);
   }
+}
+
+// shrink after a delete; only here, so a pre-sized empty table stays put
+static void ht_autoshrink(hashtable_t *ht) {
+
+  if (ht->min_load > 0 && HT_READ(ht->size) > 1 &&
+      HT_READ(ht->count) < ht->min_load * HT_READ(ht->size)) {
+    ht_lock_all(ht);
+    if (ht->size > 1 && ht->count < ht->min_load * ht->size) {
+      ht->shrink_count++;
+      ht_resize(ht, ht->size / 2);
+    }
+    ht_unlock_all(ht);
+  }
+}
 
-  // didn't return, create new and add to list.
-  b = malloc(sizeof(bucket_t));
+// slot in the array that currently holds key's chain (old one if not yet moved)
+static bucket_t **ht_chain(hashtable_t *ht, unsigned long h) {
+
+  // unlocked callers can see a migration finish halfway: old_size may be 0
+  bucket_t **old = HT_READ(ht->old_buckets);
+  unsigned long old_size = HT_READ(ht->old_size);
+  if (old && old_size) {
+    unsigned int oidx = h % old_size;
+    if (oidx >= HT_READ(ht->migrate_idx))
+      return &old[oidx];
+  }
+  return &HT_READ(ht->buckets)[(unsigned int)(h % HT_READ(ht->size))];
+}
+
+/* Chain for h, with its stripe held in thread-safe builds. The chain is
+   picked before the lock is held, so check it didn't move in between; the
+   address is only used to pick the stripe until then. */
+static bucket_t **ht_lock_chain(hashtable_t *ht, unsigned long h) {
+
+#ifdef HT_THREADSAFE
+  bucket_t **head = ht_chain(ht, h);
+  for (;;) {
+    bucket_t **now;
+    pthread_mutex_lock(HT_STRIPE(ht, head));
+    if ((now = ht_chain(ht, h)) == head)
+      return head;
+    HT_UNLOCK(ht, head);
+    head = now;
+  }
+#else
+  return ht_chain(ht, h);
+#endif
+}
+
+#ifndef HT_THREADSAFE
+static int ht_over_budget(hashtable_t *ht) {
+  return (ht->cache_entries && ht->count > ht->cache_entries) ||
+         (ht->cache_bytes && ht->bytes > ht->cache_bytes);
+}
+
+// evict until back in budget, never keep (the entry just put)
+static void ht_evict(hashtable_t *ht, bucket_t *keep) {
+
+  while (ht_over_budget(ht) && ht->clock_n > 1) {
+    bucket_t *b = ht->clock[ht->clock_hand];
+    if (b == keep || (b->clock & HT_REF)) {
+      b->clock &= ~HT_REF;
+      ht->clock_hand = (ht->clock_hand + 1) % ht->clock_n;
+      continue;
+    }
+    // unlink b from its chain; its slot then holds the next candidate
+    bucket_t **head = ht_chain(ht, b->hash), **link = head;
+    ht_tree_t **slot = ht_tree_slot(ht, head, 0);
+    unsigned long len, probes;
+    if (slot && *slot) {
+      ht_tree_seek(*slot, head, b->hash, b->key, b->klen, &link, &probes);
+      len = (*slot)->n;
+    } else {
+      len = ht_chain_length(*head);
+      while (*link != b)
+        link = &(*link)->next;
+    }
+    *link = b->next;
+    ht->count--;
+    ht_chain_changed(ht, len, len - 1);
+    if (slot && *slot)
+      ht_tree_del(ht, slot, b);
+    ht_bloom_note(ht, b->hash, 0);
+    ht->evictions++;
+    ht_drop(ht, b);
+  }
+}
+#endif
+
+/* Put node nb (key, val and hash set) into its chain. A node already there
+   with the same key is unlinked and dropped, key, value and all; nb is
+   swapped in rather than the old node rewritten, since the two may differ
+   in layout and, in thread-safe builds, readers may be looking at the old
+   one. */
+static void ht_link(hashtable_t *ht, bucket_t *nb) {
+
+  ht_step(ht);
+
+  // check the bucket for key match
+  bucket_t **head = ht_lock_chain(ht, nb->hash);
+  bucket_t **link = head;
+  bucket_t *b = *head;
+  unsigned long len = 0, probes;
+#ifndef HT_THREADSAFE
+  ht_tree_t *tree = ht_tree_of(ht, head);
+  ht_tnode_t *tn = NULL;
+
+  if (tree) {
+    tn = ht_tree_seek(tree, head, nb->hash, nb->key, nb->klen, &link, &probes);
+    b = tn ? tn->b : NULL;
+    len = tree->n;
+  } else
+#endif
+  {
+    while (b && !HT_MATCH(b, nb->hash, nb->key, nb->klen)) {
+      // no match, go next in LList
+      len++;
+      link = &b->next;
+      b = b->next;
+    }
+    probes = len + (b != NULL);
+    // a new key is prepended
+    if (!b)
+      link = head;
+  }
+
+  if (b) {
+    nb->next = b->next;
+    HT_WRITE(*link, nb);
+#ifndef HT_THREADSAFE
+    if (tn)
+      tn->b = nb;
+#endif
+    HT_UNLOCK(ht, head);
+    ht_probed(ht, probes);
+#ifndef HT_THREADSAFE
+    if (ht->cache)
+      ht_clock_replace(ht, b, nb);
+#endif
+    ht_drop(ht, b);
+#ifndef HT_THREADSAFE
+    if (ht->cache)
+      ht_evict(ht, nb);
+#endif
+    return;
+  }
+
+  // didn't return, add to list
+  nb->next = *link;
+  HT_WRITE(*link, nb);
+  HT_ADD(ht->count, 1);
+  ht_chain_changed(ht, len, len + 1);
+  ht_probed(ht, probes);
+#ifndef HT_THREADSAFE
+  if (tree)
+    ht_tree_add(tree, nb);
+  else if (len + 1 > HT_TREEIFY)
+    ht_treeify(ht, head);
+  ht_bloom_note(ht, nb->hash, 1);
+  ht_snap_retire(ht, nb->key, nb->klen);
+#endif
+  HT_UNLOCK(ht, head);
+  ht_autogrow(ht);
+#ifndef HT_THREADSAFE
+  if (ht->cache) {
+    ht_clock_add(ht, nb);
+    ht_evict(ht, nb);
+  }
+#endif
+}
+
+void ht_put(hashtable_t *ht, char *key, void *val) {
+  ht_put_n(ht, key, strlen(key), val);
+}
+
+void ht_put_n(hashtable_t *ht, char *key, unsigned long len, void *val) {
+
+  bucket_t *b = ht_node(ht);
   b->key = key;
   b->val = val;
+  b->klen = len;
+  b->clock = 0;
+  b->hash = ht_hash(ht, key, len);
+  ht_link(ht, b);
+}
+
+void ht_put_copy(hashtable_t *ht, const char *key, const void *val,
+                 unsigned long vlen) {
+
+  // header, key, then value at the next pointer-aligned offset
+  unsigned long klen = strlen(key);
+  unsigned long kspace = (klen + sizeof(void *)) & ~(sizeof(void *) - 1);
+  bucket_t *b = ht_inline_node(ht, sizeof(bucket_t) + kspace + vlen);
 
-  // creating one points to old next (prepend LList)
-  b->next = ht->buckets[idx];
-  ht->buckets[idx] = b;
+  b->key = memcpy(b + 1, key, klen + 1);
+  b->val = memcpy(b->key + kspace, val, vlen);
+  b->klen = klen;
+  b->clock = 0;
+  b->hash = ht_hash(ht, b->key, klen);
+  ht_link(ht, b);
 }
 
-void *ht_get(hashtable_t *ht, char *key) {
-  unsigned int idx = hash(key) % ht->size;
-  bucket_t *b = ht->buckets[idx];
-  while (b) {
-    if (strcmp(b->key, key) == 0) {
-      return b->val;
+#ifdef HT_THREADSAFE
+/* Lock-free lookup. Returns 0 if a rehash or migration overlapped it (seq
+   odd or changed), in which case a miss can't be trusted. */
+static int ht_get_nolock(hashtable_t *ht, unsigned long h, char *key,
+                         unsigned long len, void **val) {
+
+  unsigned long seq = ht_seq_read(ht), n = 0;
+  bucket_t **head, *b;
+
+  if (seq & 1)
+    return 0;
+  head = ht_chain(ht, h);
+  // arrays and sizes must belong together before head is dereferenced
+  if (!ht_seq_check(ht, seq))
+    return 0;
+
+  for (b = HT_READ(*head); b; b = HT_READ(b->next)) {
+    n++;
+    if (HT_MATCH(b, h, key, len)) {
+      *val = b->val;
+      ht_probed(ht, n);
+      return 1;
     }
-    b = b->next;
   }
+  *val = NULL;
+  if (!ht_seq_check(ht, seq))
+    return 0;
+  ht_probed(ht, n);
+  return 1;
+}
+#endif
+
+// ht_get once the migration step is done and the hash known
+static void *ht_get_hashed(hashtable_t *ht, unsigned long h, char *key,
+                           unsigned long len) {
+
+#ifdef HT_THREADSAFE
+  void *val;
+  int done;
+
+  epoch_enter();
+  done = ht_get_nolock(ht, h, key, len, &val);
+  epoch_exit();
+  if (done) {
+    if (ht->probe_stats)
+      HT_ADD(*(val ? &ht->hits : &ht->misses), 1);
+    return val;
+  }
+#endif
+
+#ifndef HT_THREADSAFE
+  void *snapval;
+
+  // a definite miss never reaches the chain (the filter only has the chains)
+  if (ht->bloom && !ht_bloom_test(ht->bloom, ht->bloom_blocks, h)) {
+    ht->bloom_negatives++;
+    ht_probed(ht, 0);
+    snapval = ht_snap_get(ht, key, len);
+    if (ht->probe_stats || ht->cache)
+      (*(snapval ? &ht->hits : &ht->misses))++;
+    return snapval;
+  }
+#endif
+
+  // raced a rehash (or plain build): walk the chain under its lock
+  bucket_t **head = ht_lock_chain(ht, h);
+  bucket_t *b = *head;
+  unsigned long n = 0;
+#ifndef HT_THREADSAFE
+  ht_tree_t *tree = ht_tree_of(ht, head);
+  ht_tnode_t *tn;
+  bucket_t **link;
+
+  if (tree) {
+    tn = ht_tree_seek(tree, head, h, key, len, &link, &n);
+    b = tn ? tn->b : NULL;
+  } else
+#endif
+  for (; b; b = b->next) {
+    n++;
+    if (HT_MATCH(b, h, key, len))
+      break;
+  }
+  if (b) {
+    void *val = b->val;
+    HT_UNLOCK(ht, head);
+    ht_probed(ht, n);
+    if (HT_CACHE(ht))
+      b->clock |= HT_REF;
+    if (ht->probe_stats || HT_CACHE(ht))
+      HT_ADD(ht->hits, 1);
+    return val;
+  }
+  HT_UNLOCK(ht, head);
+  ht_probed(ht, n);
+#ifndef HT_THREADSAFE
+  if (ht->bloom)
+    ht->bloom_false_pos++;
+  if ((snapval = ht_snap_get(ht, key, len))) {
+    if (ht->probe_stats || ht->cache)
+      ht->hits++;
+    return snapval;
+  }
+#endif
+  if (ht->probe_stats || HT_CACHE(ht))
+    HT_ADD(ht->misses, 1);
   return NULL;
 }
 
-void ht_iter(hashtable_t *ht, int (*f)(char *, void *)) {
+void *ht_get(hashtable_t *ht, char *key) {
+  return ht_get_n(ht, key, strlen(key));
+}
 
-  //does the order of iteration matter
+void *ht_get_n(hashtable_t *ht, char *key, unsigned long len) {
+
+#ifndef HT_THREADSAFE
+  // thread-safe reads leave migration to writers: a step locks every stripe
+  ht_step(ht);
+#endif
+  return ht_get_hashed(ht, ht_hash(ht, key, len), key, len);
+}
+
+/* Batches go in groups of HT_BATCH keys, one pass per level of the lookup:
+   hash every key and prefetch its chain slot, then prefetch every first
+   node, then every first key, and only then walk the chains. The misses of
+   a group overlap instead of each stalling the next lookup. */
+#define HT_BATCH 16
+
+unsigned long ht_get_many(hashtable_t *ht, char **keys, unsigned long n,
+                          void **vals) {
+
+  unsigned long h[HT_BATCH], len[HT_BATCH], i, j, m, found = 0;
+  bucket_t **head[HT_BATCH], *b;
+
+  for (i = 0; i < n; i += HT_BATCH) {
+    m = n - i < HT_BATCH ? n - i : HT_BATCH;
+#ifndef HT_THREADSAFE
+    // do the group's migration steps up front so its chains stay put
+    for (j = 0; j < m; j++)
+      ht_step(ht);
+#else
+    // prefetches dereference nodes; keep them from being reclaimed meanwhile,
+    // and skip them if a rehash moved the arrays under us
+    epoch_enter();
+    unsigned long seq = ht_seq_read(ht);
+#endif
+    for (j = 0; j < m; j++) {
+      len[j] = strlen(keys[i + j]);
+      h[j] = ht_hash(ht, keys[i + j], len[j]);
+      head[j] = ht_chain(ht, h[j]);
+      __builtin_prefetch(head[j]);
+    }
+#ifdef HT_THREADSAFE
+    if (ht_seq_check(ht, seq))
+#endif
+    {
+      for (j = 0; j < m; j++) {
+        if ((b = HT_READ(*head[j])))
+          __builtin_prefetch(b);
+      }
+      for (j = 0; j < m; j++) {
+        if ((b = HT_READ(*head[j])))
+          __builtin_prefetch(b->key);
+      }
+    }
+    for (j = 0; j < m; j++) {
+      vals[i + j] = ht_get_hashed(ht, h[j], keys[i + j], len[j]);
+      found += vals[i + j] != NULL;
+    }
+#ifdef HT_THREADSAFE
+    epoch_exit();
+#endif
+  }
+  return found;
+}
+
+void ht_put_many(hashtable_t *ht, char **keys, void **vals, unsigned long n) {
+
+  bucket_t *nb[HT_BATCH], **head[HT_BATCH], *b;
+  unsigned long i, j, m;
+
+  for (i = 0; i < n; i += HT_BATCH) {
+    m = n - i < HT_BATCH ? n - i : HT_BATCH;
+#ifdef HT_THREADSAFE
+    epoch_enter();
+    unsigned long seq = ht_seq_read(ht);
+#endif
+    for (j = 0; j < m; j++) {
+      nb[j] = ht_node(ht);
+      nb[j]->key = keys[i + j];
+      nb[j]->val = vals[i + j];
+      nb[j]->klen = strlen(keys[i + j]);
+      nb[j]->clock = 0;
+      nb[j]->hash = ht_hash(ht, keys[i + j], nb[j]->klen);
+      head[j] = ht_chain(ht, nb[j]->hash);
+      __builtin_prefetch(head[j]);
+    }
+#ifdef HT_THREADSAFE
+    if (ht_seq_check(ht, seq))
+#endif
+    {
+      for (j = 0; j < m; j++) {
+        if ((b = HT_READ(*head[j])))
+          __builtin_prefetch(b);
+      }
+    }
+#ifdef HT_THREADSAFE
+    epoch_exit();
+#endif
+    // ht_link finds the chain again: an earlier put of the group may resize
+    for (j = 0; j < m; j++)
+      ht_link(ht, nb[j]);
+  }
+}
+
+static int ht_iter_buckets(bucket_t **buckets, unsigned long size,
+                           int (*f)(char *, void *)) {
   bucket_t *b;
   unsigned long i;
-  for (i = 0; i < ht->size; i++) {
-    b = ht->buckets[i];
+  for (i = 0; i < size; i++) {
+    b = buckets[i];
     while (b) {
       if (!f(b->key, b->val)) {
-        return; // abort iteration
+        return 0; // abort iteration
       }
       b = b->next;
     }
   }
+  return 1;
+}
+
+void ht_iter(hashtable_t *ht, int (*f)(char *, void *)) {
+
+  //does the order of iteration matter
+  ht_lock_all(ht);
+  if (!ht_iter_buckets(ht->buckets, ht->size, f)) {
+    ht_unlock_all(ht);
+    return;
+  }
+  // buckets not migrated yet (moved ones are NULL)
+  if (ht->old_buckets && !ht_iter_buckets(ht->old_buckets, ht->old_size, f)) {
+    ht_unlock_all(ht);
+    return;
+  }
+#ifndef HT_THREADSAFE
+  // then the saved entries still live
+  for (unsigned long s = 0; ht->snap && s < fz_slots(ht->snap); s++) {
+    char *key;
+    void *val = fz_at(ht->snap, s, &key, NULL);
+    if (val && !(ht->snap_gone[s / 64] & 1UL << s % 64) && !f(key, val))
+      break;
+  }
+#endif
+  ht_unlock_all(ht);
+}
+
+/* Cursor walk (ht_scan). A size s = b * 2^k (b odd) sends a key with hash h
+   to h % s = r + b * q, with r = h % b and q the low k bits of h / b; b
+   survives doubling and halving, so within a residue r the buckets behave
+   like a power-of-two table indexed by the bits of q. Residues are walked
+   in order and, within one, q counts in reverse binary (Redis SCAN): a
+   resize then only splits or merges buckets the walk has already passed
+   into ones it has passed, or not yet reached into ones it hasn't.
+   The cursor is the next bucket index r + b * q, tagged in the bits from
+   HT_SCAN_SHIFT up with b; a resize that changed b restarts the walk. */
+#define HT_SCAN_SHIFT 48
+#define HT_SCAN_POS(c) ((c) & ((1UL << HT_SCAN_SHIFT) - 1))
+
+static unsigned long ht_scan_base(unsigned long size) {
+  return size >> __builtin_ctzl(size);
+}
+
+static unsigned long ht_scan_tag(unsigned long b) {
+  return (b & ((1UL << (64 - HT_SCAN_SHIFT)) - 1)) << HT_SCAN_SHIFT;
+}
+
+static unsigned long ht_rev(unsigned long v) {
+  v = (v >> 1 & 0x5555555555555555UL) | (v & 0x5555555555555555UL) << 1;
+  v = (v >> 2 & 0x3333333333333333UL) | (v & 0x3333333333333333UL) << 2;
+  v = (v >> 4 & 0x0f0f0f0f0f0f0f0fUL) | (v & 0x0f0f0f0f0f0f0f0fUL) << 4;
+  return __builtin_bswap64(v);
+}
+
+static void ht_scan_add(ht_scan_out_t *out, char *key, void *val,
+                        unsigned long klen) {
+  if (out->n == out->cap) {
+    out->cap = out->cap ? out->cap * 2 : 16;
+    out->entries = realloc(out->entries, out->cap * sizeof(ht_entry_t));
+  }
+  out->entries[out->n].key = key;
+  out->entries[out->n].val = val;
+  out->entries[out->n].klen = klen;
+  out->n++;
+}
+
+static void ht_scan_chain(bucket_t *b, ht_scan_out_t *out) {
+  for (; b; b = b->next)
+    ht_scan_add(out, b->key, b->val, b->klen);
+}
+
+unsigned long ht_scan(hashtable_t *ht, unsigned long cursor, unsigned long batch,
+                      ht_scan_out_t *out) {
+
+  bucket_t **t0, **t1;
+  unsigned long b, r, q, m0, m1;
+
+  out->n = 0;
+  if (batch == 0)
+    batch = 1;
+#ifndef HT_THREADSAFE
+  /* A loaded table's saved entries come first, batch slots a call: their
+     cursors are the next slot + 1, with no tag, up to fz_slots + 1, which
+     starts the chains. A saved key put again meanwhile is either behind
+     the walk already or in the chains before the walk gets there. */
+  if (ht->snap && cursor <= fz_slots(ht->snap)) {
+    unsigned long slot = cursor ? cursor - 1 : 0, klen;
+    char *key;
+    void *val;
+
+    for (; slot < fz_slots(ht->snap) && batch > 0; slot++, batch--) {
+      val = fz_at(ht->snap, slot, &key, &klen);
+      if (val && !(ht->snap_gone[slot / 64] & 1UL << slot % 64))
+        ht_scan_add(out, key, val, klen);
+    }
+    return slot + 1;
+  }
+#endif
+  ht_lock_all(ht);
+  // draining into an array of another family: nothing to line up, finish it
+  if (ht->old_buckets && ht_scan_base(ht->old_size) != ht_scan_base(ht->size)) {
+    ht_seq_begin(ht);
+    ht_migrate(ht, ht->old_size);
+    ht_seq_end(ht);
+  }
+  // t0 is the smaller array, t1 the larger; the same one outside a migration
+  t0 = t1 = ht->buckets;
+  b = ht_scan_base(ht->size);
+  m0 = m1 = ht->size / b - 1;
+  if (ht->old_buckets) {
+    if (ht->old_size < ht->size) {
+      t0 = ht->old_buckets;
+      m0 = ht->old_size / b - 1;
+    } else {
+      t1 = ht->old_buckets;
+      m1 = ht->old_size / b - 1;
+    }
+  }
+
+  if (cursor && (cursor & ~HT_SCAN_POS(~0UL)) != ht_scan_tag(b))
+    cursor = 0;
+  r = HT_SCAN_POS(cursor) % b;
+  q = HT_SCAN_POS(cursor) / b;
+  do {
+    ht_scan_chain(t0[r + b * (q & m0)], out);
+    if (t1 != t0) {
+      // every bucket of the larger array that merges into that one
+      do {
+        ht_scan_chain(t1[r + b * (q & m1)], out);
+        q = (((q | m0) + 1) & ~m0) | (q & m0);
+      } while (q & (m0 ^ m1));
+    }
+    // reverse-binary increment over the smaller array's bits of q
+    q = ht_rev(ht_rev(q | ~m0) + 1);
+    if (q == 0 && ++r == b) {
+      ht_unlock_all(ht);
+      return 0;
+    }
+  } while (--batch > 0);
+  ht_unlock_all(ht);
+  return ht_scan_tag(b) | (r + b * q);
 }
 
 void ht_del(hashtable_t *ht, char *key) {
+  ht_del_n(ht, key, strlen(key));
+}
+
+void ht_del_n(hashtable_t *ht, char *key, unsigned long len) {
   //complexity O(1) + O(b)... only bad if unbalanced hash or low buckets
-  
-  unsigned int idx = hash(key) % ht->size;
-  bucket_t *b = ht->buckets[idx];
+
+  ht_step(ht);
+
+  unsigned long h = ht_hash(ht, key, len);
+  bucket_t **head = ht_lock_chain(ht, h);
+  bucket_t *b = *head;
   bucket_t *priorb = NULL;
+  unsigned long chain = 0;
+
+#ifndef HT_THREADSAFE
+  // tree bin: the tree finds the node and the link to it
+  ht_tree_t **slot = ht_tree_slot(ht, head, 0);
+  if (slot && *slot) {
+    bucket_t **link;
+    ht_tnode_t *tn = ht_tree_seek(*slot, head, h, key, len, &link, &chain);
+    if (tn) {
+      b = tn->b;
+      *link = b->next;
+      chain = (*slot)->n;
+      ht->count--;
+      ht_chain_changed(ht, chain, chain - 1);
+      ht_tree_del(ht, slot, b);
+      ht_bloom_note(ht, h, 0);
+      ht_drop(ht, b);
+      ht_autoshrink(ht);
+    } else {
+      ht_snap_retire(ht, key, len);
+    }
+    return;
+  }
+#endif
 
   while (b) {
 
-    if (strcmp(b->key, key) == 0) {
+    chain++;
+    if (HT_MATCH(b, h, key, len)) {
       if (priorb == NULL) {
-        ht->buckets[idx] = b->next;
+        HT_WRITE(*head, b->next);
       } else {
-        priorb->next = b->next;
+        HT_WRITE(priorb->next, b->next);
       }
 
-      free_bucket(b);
+      // the rest of the chain, for its length
+      chain += ht_chain_length(b->next);
+      HT_ADD(ht->count, -1);
+      ht_chain_changed(ht, chain, chain - 1);
+#ifndef HT_THREADSAFE
+      ht_bloom_note(ht, h, 0);
+#endif
+      HT_UNLOCK(ht, head);
+      ht_drop(ht, b);
+      ht_autoshrink(ht);
       return;
     }
 
@@ -106,51 +1358,298 @@ void ht_del(hashtable_t *ht, char *key) {
     priorb = b;
     b = b->next;
   }
+  HT_UNLOCK(ht, head);
+#ifndef HT_THREADSAFE
+  ht_snap_retire(ht, key, len);
+#endif
 }
 
-void ht_rehash(hashtable_t *ht, unsigned long newsize) {
+/* Parallel all-at-once rehash (opts.rehash_threads). The old array is cut
+   into one contiguous range per thread and the new array's buckets are
+   dealt to threads by index range too. Pass 1: each thread walks its old
+   range and appends every node, in the order it visits them, to the outbox
+   of the thread owning the node's new bucket. Pass 2: each thread prepends
+   the outboxes addressed to it, in old range order, into its new buckets.
+   A new chain thus sees its nodes in the serial loop's order, and ends up
+   exactly as the serial rehash would build it. Each thread then counts the
+   chain lengths of its new buckets for chains[]. */
+#define HT_PAR_MIN 1024  // old buckets a thread must get to be worth starting
+
+typedef struct ht_outbox {
+  bucket_t *head, *tail;
+} ht_outbox_t;
+
+typedef struct ht_par {
+  bucket_t **buckets, **newbuckets;
+  unsigned long size, newsize, nthreads;
+  ht_outbox_t *outbox;  // nthreads x nthreads, [from][to]
+} ht_par_t;
+
+typedef struct ht_par_worker {
+  ht_par_t *par;
+  unsigned long id;
+  unsigned long chains[HT_STAT_LENS];
+  pthread_t tid;
+  int started;
+} ht_par_worker_t;
+
+// add the lengths of buckets [lo, hi) to a chains[] histogram
+static void ht_count_chains(unsigned long *chains, bucket_t **buckets,
+                            unsigned long lo, unsigned long hi) {
+  for (unsigned long i = lo; i < hi; i++) {
+    if (buckets[i])
+      chains[ht_stat_slot(ht_chain_length(buckets[i]))]++;
+  }
+}
+
+static void *ht_par_scatter(void *arg) {
+
+  ht_par_worker_t *w = arg;
+  ht_par_t *par = w->par;
+  ht_outbox_t *out = &par->outbox[w->id * par->nthreads], *o;
+  unsigned long lo = w->id * par->size / par->nthreads;
+  unsigned long hi = (w->id + 1) * par->size / par->nthreads;
+
+  for (unsigned long i = lo; i < hi; i++) {
+    bucket_t *b = par->buckets[i];
+    while (b) {
+      bucket_t *nextb = b->next;
+      o = &out[b->hash % par->newsize * par->nthreads / par->newsize];
+      HT_WRITE(b->next, NULL);
+      if (o->tail)
+        HT_WRITE(o->tail->next, b);
+      else
+        o->head = b;
+      o->tail = b;
+      b = nextb;
+    }
+  }
+  return NULL;
+}
+
+static void *ht_par_gather(void *arg) {
+
+  ht_par_worker_t *w = arg;
+  ht_par_t *par = w->par;
+
+  for (unsigned long t = 0; t < par->nthreads; t++) {
+    bucket_t *b = par->outbox[t * par->nthreads + w->id].head;
+    while (b) {
+      unsigned long nidx = b->hash % par->newsize;
+      bucket_t *nextb = b->next;
+      HT_WRITE(b->next, par->newbuckets[nidx]);
+      par->newbuckets[nidx] = b;
+      b = nextb;
+    }
+  }
+  // the new buckets dealt to this thread: nidx * nthreads / newsize == id
+  ht_count_chains(w->chains, par->newbuckets,
+                  (w->id * par->newsize + par->nthreads - 1) / par->nthreads,
+                  ((w->id + 1) * par->newsize + par->nthreads - 1) / par->nthreads);
+  return NULL;
+}
+
+// run fn for every worker; any that can't get a thread runs here instead
+static void ht_par_run(ht_par_worker_t *w, unsigned long n, void *(*fn)(void *)) {
+
+  for (unsigned long i = 1; i < n; i++)
+    w[i].started = pthread_create(&w[i].tid, NULL, fn, &w[i]) == 0;
+  fn(&w[0]);
+  for (unsigned long i = 1; i < n; i++) {
+    if (w[i].started)
+      pthread_join(w[i].tid, NULL);
+    else
+      fn(&w[i]);
+  }
+}
+
+// move every chain of ht->buckets into newbuckets, adding the new lengths
+// to chains; 0 if not worth threads
+static int ht_rehash_parallel(hashtable_t *ht, bucket_t **newbuckets,
+                              unsigned long newsize, unsigned long *chains) {
+
+  unsigned long n = ht->rehash_threads, i, l;
+  ht_par_worker_t *w;
+  ht_par_t par;
+
+  if (n > ht->size / HT_PAR_MIN)
+    n = ht->size / HT_PAR_MIN;
+  if (n < 2)
+    return 0;
+
+  par.buckets = ht->buckets;
+  par.newbuckets = newbuckets;
+  par.size = ht->size;
+  par.newsize = newsize;
+  par.nthreads = n;
+  par.outbox = calloc(n * n, sizeof(ht_outbox_t));
+  w = calloc(n, sizeof(ht_par_worker_t));
+  for (i = 0; i < n; i++) {
+    w[i].par = &par;
+    w[i].id = i;
+  }
+  ht_par_run(w, n, ht_par_scatter);
+  ht_par_run(w, n, ht_par_gather);
+  for (i = 0; i < n; i++) {
+    for (l = 0; l < HT_STAT_LENS; l++)
+      chains[l] += w[i].chains[l];
+  }
+  free(w);
+  free(par.outbox);
+  return 1;
+}
+
+// ht_rehash with every stripe already held
+static void ht_resize(hashtable_t *ht, unsigned long newsize) {
   //currently this is using O(n) space, O(n) time to scale all
 
+  ht_seq_begin(ht);
+
+  // a second rehash while one is still draining: finish the first
+  if (ht->old_buckets)
+    ht_migrate(ht, ht->old_size);
+
   // new buckets array of new size within ht.
   bucket_t **newbuckets = calloc(newsize, sizeof(bucket_t *));
 
-  for (int i = 0; i < ht->size; i++) {
-    bucket_t *b = ht->buckets[i];
-    while (b) {
-      // 1. evaluate the bucket's key hash with new size
-      unsigned int nidx = hash(b->key) % newsize;
+  if (ht->rehash_steps) {
+    // keep the current array as "old" and let operations drain it
+    HT_WRITE(ht->old_buckets, ht->buckets);
+    HT_WRITE(ht->old_size, ht->size);
+    HT_WRITE(ht->migrate_idx, 0);
+    HT_WRITE(ht->buckets, newbuckets);
+    HT_WRITE(ht->size, newsize);
+#ifndef HT_THREADSAFE
+    // the trees stay with the array their chains are in
+    ht->old_trees = ht->trees;
+    ht->trees = NULL;
+    if (ht->bloom) {
+      ht->next_bloom_blocks = ht_bloom_size(ht, newsize);
+      ht->next_bloom = ht_bloom_alloc(ht->next_bloom_blocks);
+    }
+#endif
+    ht_migrate(ht, ht->rehash_steps);
+    ht_seq_end(ht);
+    return;
+  }
+
+#ifndef HT_THREADSAFE
+  // the chains are rebuilt from scratch, and the trees after them
+  ht_free_trees(ht, ht->trees, ht->size);
+  ht->trees = NULL;
+#endif
 
-      // 2. save the "next bucket" for iteration purposes
-      bucket_t * nextb = b->next;
+  // large tables may go to threads; same chains either way
+  unsigned long chains[HT_STAT_LENS] = { 0 };
+  if (!ht_rehash_parallel(ht, newbuckets, newsize, chains)) {
+    for (int i = 0; i < ht->size; i++) {
+      bucket_t *b = ht->buckets[i];
+      while (b) {
+        // 1. evaluate the bucket's stored hash with new size (key untouched)
+        unsigned int nidx = b->hash % newsize;
 
-      // 3. place "old bucket" in "new buckets" with prepend (no freeing b/c data maintained)
-      b->next = newbuckets[nidx];
-      newbuckets[nidx] = b;
+        // 2. save the "next bucket" for iteration purposes
+        bucket_t * nextb = b->next;
 
-      // 4. put the "next bucket" from current hash table as "b"
-      b = nextb;
+        // 3. place "old bucket" in "new buckets" with prepend (no freeing b/c data maintained)
+        HT_WRITE(b->next, newbuckets[nidx]);
+        newbuckets[nidx] = b;
+
+        // 4. put the "next bucket" from current hash table as "b"
+        b = nextb;
+      }
+    }
+    ht_count_chains(chains, newbuckets, 0, newsize);
+  }
+  for (int l = 0; l < HT_STAT_LENS; l++)
+    HT_WRITE(ht->chains[l], chains[l]);
+
+#ifndef HT_THREADSAFE
+  // a filter sized for the new array, from the hashes the nodes carry
+  if (ht->bloom) {
+    free(ht->bloom);
+    ht->bloom_blocks = ht_bloom_size(ht, newsize);
+    ht->bloom = ht_bloom_alloc(ht->bloom_blocks);
+    for (unsigned long i = 0; i < newsize; i++) {
+      for (bucket_t *b = newbuckets[i]; b; b = b->next)
+        ht_bloom_update(ht->bloom, ht->bloom_blocks, b->hash, 1);
     }
   }
+#endif
 
   // fix pointer of newbuckets to ht->buckets after freeing it...
-  free(ht->buckets);
-  ht->buckets = newbuckets;
-  ht->size = newsize;
+  HT_RETIRE(ht->buckets, free);
+  HT_WRITE(ht->buckets, newbuckets);
+  HT_WRITE(ht->size, newsize);
+
+#ifndef HT_THREADSAFE
+  // chains[] tells whether any chain is long enough to need a tree
+  for (int l = HT_TREEIFY + 1; l < HT_STAT_LENS; l++) {
+    if (chains[l]) {
+      for (unsigned long i = 0; i < newsize; i++) {
+        if (ht_chain_length(newbuckets[i]) > HT_TREEIFY)
+          ht_treeify(ht, &newbuckets[i]);
+      }
+      break;
+    }
+  }
+#endif
+  ht_seq_end(ht);
+}
+
+void ht_stats(hashtable_t *ht, ht_stats_t *st) {
+
+  memset(st, 0, sizeof(ht_stats_t));
+  st->entries = HT_READ(ht->count);
+  st->buckets = HT_READ(ht->size) + HT_READ(ht->old_size);
+  for (unsigned long l = 0; l < HT_STAT_LENS; l++) {
+    st->chains[l] = HT_READ(ht->chains[l]);
+    st->probes[l] = HT_READ(ht->probes[l]);
+    st->nonempty += st->chains[l];
+    if (st->chains[l])
+      st->max_chain = l;
+  }
+  st->hits = HT_READ(ht->hits);
+  st->misses = HT_READ(ht->misses);
+  st->grows = HT_READ(ht->grow_count);
+  st->shrinks = HT_READ(ht->shrink_count);
+#ifndef HT_THREADSAFE
+  st->evictions = ht->evictions;
+  st->bytes = ht->bytes;
+  st->bloom_negatives = ht->bloom_negatives;
+  st->bloom_false_pos = ht->bloom_false_pos;
+  st->bloom_bytes = (ht->bloom ? ht->bloom_blocks * HT_BLOOM_BLOCK : 0) +
+                    (ht->next_bloom ? ht->next_bloom_blocks * HT_BLOOM_BLOCK : 0);
+  st->trees = ht->ntrees;
+  if (ht->snap) {
+    st->entries += ht->snap_live;
+    st->snap_entries = ht->snap_live;
+    st->snap_bytes = fz_bytes(ht->snap);
+  }
+#endif
+}
+
+void ht_rehash(hashtable_t *ht, unsigned long newsize) {
+  ht_lock_all(ht);
+  ht_resize(ht, newsize);
+  ht_unlock_all(ht);
 }
 
 void free_bucket(bucket_t *b) {
-  // remove key/val ptr ref, then b itself...
-  free(b->key);
-  free(b->val);
+  // remove key/val ptr ref, then b itself... (inline ones are inside b)
+  if (!HT_INLINE(b)) {
+    free(b->key);
+    free(b->val);
+  }
   // b.next is a pointer to the next bucket, which may still be in use.
   free(b);
 }
 
-void free_hashtable(hashtable_t *ht) {
-  // free each bucket and its contents; loop over size worht buckets
-  for (int i = 0; i < ht->size; i++) {
-    if (ht->buckets[i] != NULL) {
-      bucket_t *b = ht->buckets[i];
+#ifdef HT_THREADSAFE
+static void free_buckets(bucket_t **buckets, unsigned long size) {
+  for (int i = 0; i < size; i++) {
+    if (buckets[i] != NULL) {
+      bucket_t *b = buckets[i];
       bucket_t *b_next;
       while (b != NULL) {
         // scale the linked list, free prior ones.
@@ -159,11 +1658,158 @@ void free_hashtable(hashtable_t *ht) {
         b = b_next;
       }
       // null out the bucket ref... not sure if needed but we'll do it.
-      ht->buckets[i] = NULL;
+      buckets[i] = NULL;
+    }
+  }
+}
+
+#else
+// slab nodes go back with the slab; only heap keys/values and inline
+// nodes need a walk
+static void free_buckets(hashtable_t *ht, bucket_t **buckets, unsigned long size) {
+  if (ht->use_arena)
+    return;
+  for (unsigned long i = 0; i < size; i++) {
+    bucket_t *b = buckets[i], *b_next;
+    while (b) {
+      b_next = b->next;
+      if (HT_INLINE(b)) {
+        free(b);
+      } else {
+        free(b->key);
+        free(b->val);
+      }
+      b = b_next;
     }
   }
+}
+#endif
+
+void free_hashtable(hashtable_t *ht) {
+#ifdef HT_THREADSAFE
+  // free each bucket and its contents; loop over size worht buckets
+  free_buckets(ht->buckets, ht->size);
+  if (ht->old_buckets)
+    free_buckets(ht->old_buckets, ht->old_size);
+
+  for (unsigned long i = 0; i < ht->nstripes; i++)
+    pthread_mutex_destroy(&ht->stripes[i].lock);
+  free(ht->stripes);
+#else
+  free_buckets(ht, ht->buckets, ht->size);
+  if (ht->old_buckets)
+    free_buckets(ht, ht->old_buckets, ht->old_size);
+  slab_destroy(&ht->nodes);
+  arena_destroy(&ht->arena);
+  free(ht->clock);
+  free(ht->bloom);
+  free(ht->next_bloom);
+  ht_free_trees(ht, ht->trees, ht->size);
+  ht_free_trees(ht, ht->old_trees, ht->old_size);
+  if (ht->snap)
+    free_frozen(ht->snap);
+  free(ht->snap_gone);
+#endif
+  free(ht->old_buckets);
 
   // free the memory of the allocated bucket space, then ht
   free(ht->buckets);
   free(ht);
 }
+
+#ifndef HT_THREADSAFE
+int ht_save(hashtable_t *ht, const char *path, unsigned long (*vlen)(void *val)) {
+  return ht_freeze_save(ht, path, vlen);
+}
+
+hashtable_t *ht_load(const char *path, unsigned long size, const ht_opts_t *opts) {
+  frozen_t *snap = fz_load(path);
+  hashtable_t *ht;
+
+  if (!snap)
+    return NULL;
+  if (!(ht = make_hashtable_opts(size, opts))) {
+    free_frozen(snap);
+    return NULL;
+  }
+  ht->snap = snap;
+  ht->snap_live = fz_count(snap);
+  // zero pages until a saved entry is retired
+  ht->snap_gone = calloc(fz_slots(snap) / 64 + 1, sizeof(unsigned long));
+  return ht;
+}
+
+// what a bgsave child sends back before it exits
+typedef struct ht_bg_report {
+  int ok;
+  unsigned long bytes, end_ns;
+} ht_bg_report_t;
+
+static unsigned long ht_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+int ht_bgsave(hashtable_t *ht, const char *path, unsigned long (*vlen)(void *val),
+              ht_bgsave_t *bg) {
+  int fds[2];
+
+  memset(bg, 0, sizeof(ht_bgsave_t));
+  if (pipe(fds) != 0)
+    return 0;
+  bg->start_ns = ht_now_ns();
+  bg->pid = fork();
+  if (bg->pid == 0) {
+    // the child: the table as of the fork, whatever the parent does next
+    ht_bg_report_t r = { 0 };
+    struct stat st;
+
+    close(fds[0]);
+    r.ok = ht_save(ht, path, vlen);
+    if (r.ok && stat(path, &st) == 0)
+      r.bytes = st.st_size;
+    r.end_ns = ht_now_ns();
+    r.ok = write(fds[1], &r, sizeof(r)) == sizeof(r) && r.ok;
+    // _exit: the parent's stdio buffers are not the child's to flush
+    _exit(r.ok ? 0 : 1);
+  }
+  bg->fork_ns = ht_now_ns() - bg->start_ns;
+  close(fds[1]);
+  if (bg->pid < 0) {
+    close(fds[0]);
+    bg->pid = 0;
+    return 0;
+  }
+  bg->fd = fds[0];
+  return 1;
+}
+
+int ht_bgsave_done(ht_bgsave_t *bg, int wait) {
+  ht_bg_report_t r;
+  pid_t pid;
+  ssize_t got;
+  int status = 0;
+
+  if (!bg->pid)
+    return 1;
+  // a signal is no news of the child: only reaping it (or ECHILD) is
+  do {
+    pid = waitpid(bg->pid, &status, wait ? 0 : WNOHANG);
+  } while (pid < 0 && errno == EINTR);
+  if (pid == 0)
+    return 0;
+  do {
+    got = read(bg->fd, &r, sizeof(r));
+  } while (got < 0 && errno == EINTR);
+  bg->ok = pid == bg->pid && WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+           got == sizeof(r) && r.ok;
+  if (bg->ok) {
+    bg->bytes = r.bytes;
+    bg->save_ns = r.end_ns - bg->start_ns;
+  }
+  close(bg->fd);
+  bg->pid = 0;
+  return 1;
+}
+#endif
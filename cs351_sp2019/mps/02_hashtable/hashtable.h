@@ -1,48 +1,406 @@
 #ifndef HASHTABLE_T
 #define HASHTABLE_T
 
+#include <sys/types.h>
+#include "hashfn.h"
+#include "slab.h"
+#ifdef HT_THREADSAFE
+#include <pthread.h>
+#endif
+
 typedef struct hashtable hashtable_t;
+
+#if defined(HT_ROBINHOOD) || defined(HT_SWISS)
+#define HT_OPEN_ADDRESSING
+#endif
+
+#if defined(HT_ROBINHOOD)
+
+typedef struct rh_slot rh_slot_t;
+
+/**
+ * Open-addressed slot (Robin Hood backend, built with -DHT_ROBINHOOD).
+ * psl is the probe sequence length + 1, so 0 marks an empty slot; klen is
+ * the key's length in bytes.
+ **/
+struct rh_slot {
+  unsigned long hash;
+  char *key;
+  void *val;
+  unsigned int psl, klen;
+};
+
+/**
+ * pointer to slot array, its size and the number of live entries
+ */
+struct hashtable {
+  unsigned long size;
+  unsigned long count;
+  rh_slot_t *slots;
+  ht_hash_fn hashfn;
+  unsigned long seed;
+};
+
+#elif defined(HT_SWISS)
+
+typedef struct sw_slot sw_slot_t;
+
+/**
+ * Slot of the Swiss-table backend (built with -DHT_SWISS). Its control byte
+ * lives in a separate array: 7 bits of the hash for a full slot, otherwise
+ * SW_EMPTY or SW_DELETED. Slots come in aligned groups of SW_GROUP.
+ **/
+struct sw_slot {
+  unsigned long hash;
+  char *key;
+  void *val;
+  unsigned long klen;
+};
+
+#define SW_GROUP   16
+#define SW_EMPTY   ((signed char)-128)
+#define SW_DELETED ((signed char)-2)
+// low 7 hash bits go in the control byte, the rest picks the first group
+#define SW_H1(h) ((h) >> 7)
+#define SW_H2(h) ((signed char)((h) & 0x7f))
+
+/**
+ * size slots (a power of two, multiple of SW_GROUP); growth_left counts
+ * inserts into empty slots allowed before the table must be rebuilt.
+ */
+struct hashtable {
+  unsigned long size;
+  unsigned long count;
+  unsigned long growth_left;
+  signed char *ctrl;
+  sw_slot_t *slots;
+  ht_hash_fn hashfn;
+  unsigned long seed;
+};
+
+#else
+
 typedef struct bucket bucket_t;
+typedef struct ht_tree ht_tree_t;
 
 /**
  * Linked list with key/value pair. 
- * A bucket is start of a DS to describe key matches
+ * A bucket is start of a DS to describe key matches.
+ * hash caches hash(key), so chain walks only compare keys on a full-hash
+ * match and rehashing never re-reads the key. klen is the key's length in
+ * bytes (under 4 GB): keys are compared by length, then memcmp, never scanned for a NUL.
+ * In cache mode, clock is the node's slot in the CLOCK ring + 1 (0 when
+ * not in it) with HT_REF set if it was used since the hand last passed.
  **/
 struct bucket {
   char *key;
   void *val;
   bucket_t *next;
+  unsigned long hash;
+  unsigned int klen;
+  unsigned int clock;
 };
 
+#define HT_REF  0x80000000U
+#define HT_SLOT 0x7fffffffU
+
+/** Length slots of the chain and probe histograms; longer ones share the
+    last slot. */
+#define HT_STAT_LENS 64
+
+#ifdef HT_THREADSAFE
+/** One lock per stripe of chains, padded to a cache line so neighbouring
+    stripes don't false-share. */
+typedef union ht_stripe {
+  pthread_mutex_t lock;
+  char pad[64];
+} ht_stripe_t;
+#endif
+
 /**
- * pointer to buckets array and size
+ * pointer to buckets array and size.
+ * During an incremental rehash the previous array is kept in old_buckets and
+ * drained a few buckets per operation, starting at migrate_idx.
+ * count is the number of entries; grow_count/shrink_count record how often
+ * the max_load/min_load thresholds resized the table. hashfn/seed are the
+ * configured hash (NULL means hash()). rehash_threads > 1 splits an
+ * all-at-once rehash of a large array across that many threads.
+ * chains[n] counts the chains of n entries, kept current by every change,
+ * so ht_stats never walks the table; with probe_stats, probes[n] counts
+ * gets and puts that compared n nodes, hits/misses the gets' outcomes.
+ * Nodes come from the nodes slab; with use_arena, keys and values live in
+ * arena and are only released by free_hashtable.
+ * cache is set when the table was given a budget of cache_entries entries
+ * and/or cache_bytes bytes (see ht_opts_t): every node is then also in the
+ * clock ring (clock_n of clock_cap slots used), bytes is what the live
+ * entries are charged, and puts evict at the hand until back in budget.
+ * bloom (bloom_blocks HT_BLOOM_BLOCK-byte blocks of 4-bit counters) holds
+ * every key's hash when the table was made with opts.bloom_counters; gets
+ * it rules out never walk a chain. While an incremental rehash drains,
+ * next_bloom is being filled for the new array, and replaces bloom once
+ * it is done. bloom_negatives counts gets the filter answered,
+ * bloom_false_pos those it let through that then missed.
+ * Outside -DHT_THREADSAFE, a chain longer than HT_TREEIFY also gets a
+ * balanced tree over its nodes, in trees[] (old_trees[] for old_buckets,
+ * each array made on first use); ntrees counts them.
+ * A table from ht_load also reads the saved entries in place from snap, a
+ * mapped frozen.h image under the chains. snap_gone has a bit per snap
+ * slot whose entry was overwritten or deleted since (the key is then in
+ * the chains or nowhere); snap_live counts the rest. count and the chain
+ * stats are the chains' alone.
+ * Built with -DHT_THREADSAFE, each chain is guarded by one of nstripes
+ * locks; anything that moves chains between arrays holds all of them and
+ * makes seq odd meanwhile, so lock-free readers know to retry. Nodes are
+ * plain malloc there (readers may still hold retired ones) and there is
+ * no arena.
  */
 struct hashtable {
   unsigned long size;
   bucket_t **buckets;
+  bucket_t **old_buckets;
+  unsigned long old_size;
+  unsigned long migrate_idx;
+  unsigned long rehash_steps;
+  unsigned long count;
+  double max_load, min_load;
+  unsigned long grow_count, shrink_count;
+  ht_hash_fn hashfn;
+  unsigned long seed;
+  unsigned long rehash_threads;
+  unsigned long chains[HT_STAT_LENS];
+  unsigned long probes[HT_STAT_LENS];
+  unsigned long hits, misses;
+  int probe_stats;
+#ifdef HT_THREADSAFE
+  ht_stripe_t *stripes;
+  unsigned long nstripes;
+  unsigned long seq;
+#else
+  slab_t nodes;
+  arena_t arena;
+  int use_arena;
+  int cache;
+  unsigned long cache_entries, cache_bytes;
+  unsigned long (*cache_cost)(char *key, unsigned long klen, void *val);
+  bucket_t **clock;
+  unsigned long clock_n, clock_cap, clock_hand;
+  unsigned long bytes, evictions;
+  unsigned long bloom_counters;
+  unsigned char *bloom, *next_bloom;
+  unsigned long bloom_blocks, next_bloom_blocks;
+  unsigned long bloom_negatives, bloom_false_pos;
+  ht_tree_t **trees, **old_trees;
+  unsigned long ntrees;
+  struct frozen *snap;
+  unsigned long *snap_gone;
+  unsigned long snap_live;
+#endif
 };
 
+#define HT_BLOOM_BLOCK 64
+
+#endif
+
+/**
+ * Creation-time tuning for make_hashtable_opts. A zeroed struct (or NULL)
+ * gives the same table as make_hashtable.
+ */
+typedef struct ht_opts {
+  /* buckets migrated per put/get/del after ht_rehash; 0 rehashes all at once.
+     Thread-safe builds migrate on puts and deletes only, so gets never take
+     the stripe locks: under a read-only load the old array just stays. */
+  unsigned long rehash_steps;
+  /* entries per bucket that trigger doubling / halving the bucket array on
+     put / del; 0 leaves resizing to explicit ht_rehash calls. Keep min_load
+     below max_load / 2 so a shrink doesn't immediately grow back. */
+  double max_load, min_load;
+  /* hash function (see hashfn.h) and its seed; NULL means hash() */
+  ht_hash_fn hash_fn;
+  unsigned long hash_seed;
+  /* threads for an all-at-once rehash (chained table); 0 or 1 rehashes on
+     the calling thread. Small arrays are always done serially. */
+  unsigned long rehash_threads;
+  /* count get hits/misses and get/put probe lengths for ht_stats (chained
+     table; thread-safe builds pay a few shared atomic adds per call) */
+  int probe_stats;
+  /* -DHT_THREADSAFE builds: number of chain locks; 0 picks HT_STRIPES */
+  unsigned long lock_stripes;
+  /* keys and values are made with ht_strdup and freed in bulk with the
+     table, never one by one (chained table, not thread-safe builds) */
+  int arena;
+  /* bounded cache (chained table, not thread-safe builds): once a put
+     leaves more than cache_entries entries or cache_bytes bytes (0 = no
+     limit), entries are evicted CLOCK-style, recently got ones last, as if
+     ht_del'd. An entry is charged cache_cost(key, klen, val) bytes; NULL
+     charges the node, the key and the value as a NUL-terminated string.
+     Not with arena, which would keep every evicted key and value. */
+  unsigned long cache_entries, cache_bytes;
+  unsigned long (*cache_cost)(char *key, unsigned long klen, void *val);
+  /* counting Bloom filter in front of the chains (chained table, not
+     thread-safe builds): about this many 4-bit counters per bucket, resized
+     with the bucket array. A get it rules out costs one cache line. 0 = no
+     filter; 8 gives about 2% false positives at one entry per bucket. */
+  unsigned long bloom_counters;
+} ht_opts_t;
+
+#define HT_STRIPES 256
+
+/** A key/value pair handed out by ht_scan; klen bytes of key. */
+typedef struct ht_entry {
+  char *key;
+  void *val;
+  unsigned long klen;
+} ht_entry_t;
+
+/** What one ht_scan call found: n entries, in an array ht_scan grows as
+    needed (cap slots). Start it zeroed, free entries when done. */
+typedef struct ht_scan_out {
+  ht_entry_t *entries;
+  unsigned long n, cap;
+} ht_scan_out_t;
+
+/** DJB "times 33" over a NUL-terminated string (hashfn.c). Tables hash with
+    hash_djb(key, len, 0) unless given a hash_fn, the same on ASCII keys. */
 unsigned long hash(char *str);
 
 /** Initialize hashtable with a number of buckets. Put for a given k,v pair 
     will place in bucket linked list with [hash() % size] index. */
 hashtable_t *make_hashtable(unsigned long size);
+/** Same as make_hashtable, with the tuning in opts (may be NULL).
+    Backends ignore options they have no use for. NULL if the chained
+    table is asked for both arena and a cache bound. */
+hashtable_t *make_hashtable_opts(unsigned long size, const ht_opts_t *opts);
+
+/** Copy s for use as a key or value of ht. Plain strdup unless the table was
+    made with opts.arena; then the copy belongs to the table.*/
+char *ht_strdup(hashtable_t *ht, const char *s);
 
 /** Put the value in the hashtable with the given key.*/
 void  ht_put(hashtable_t *ht, char *key, void *val);
+/** Put copies of key and of the vlen bytes at val; the caller keeps its own
+    buffers. In the chained table the copies share one block with the node,
+    key right behind the link so a short key is found in one cache line;
+    ht_get returns the pointer-aligned copy of val.*/
+void  ht_put_copy(hashtable_t *ht, const char *key, const void *val,
+                  unsigned long vlen);
 
-/** Retrieve the value for a given key.*/
+/** The *_n calls take a key as len bytes at key, which may hold NULs and
+    need not be NUL-terminated; ht_put_n owns key like ht_put. The string
+    calls are these with len = strlen(key), so a string key and its bytes
+    are the same key. ht_iter can't pass a length, use ht_scan for these.*/
+void  ht_put_n(hashtable_t *ht, char *key, unsigned long len, void *val);
+void *ht_get_n(hashtable_t *ht, char *key, unsigned long len);
+void  ht_del_n(hashtable_t *ht, char *key, unsigned long len);
+
+/** Retrieve the value for a given key. In thread-safe builds the lookup takes
+    no locks; the value is reclaimed through epoch.h once another thread
+    deletes or overwrites the key, so bracket ht_get and any use of the value
+    with epoch_enter/epoch_exit if that can happen.*/
 void *ht_get(hashtable_t *ht, char *key);
+/** ht_get for n keys at once, value (or NULL) to vals[i]; returns the number
+    found. Lookups are staged in small groups with prefetching, so their
+    cache misses overlap.*/
+unsigned long ht_get_many(hashtable_t *ht, char **keys, unsigned long n,
+                          void **vals);
+/** ht_put of keys[i] => vals[i] for i < n, in order, prefetched like
+    ht_get_many.*/
+void  ht_put_many(hashtable_t *ht, char **keys, void **vals, unsigned long n);
+/** Resumable walk: start with cursor 0, pass each returned cursor back in,
+    stop when it returns 0. Each call visits about batch buckets and puts
+    their entries in out, replacing what it held. Calls may be interleaved
+    with puts, deletes and rehashes; every key present for the whole walk
+    is still returned at least once (possibly more), provided the table was
+    only resized by factors of two, as max_load/min_load do. Another
+    rehash restarts the walk. Thread-safe builds lock the table for one
+    call only; entries are then subject to epoch.h like ht_get's values.
+    The open-addressing backends walk slots in order and promise this only
+    while the table is not modified. */
+unsigned long ht_scan(hashtable_t *ht, unsigned long cursor, unsigned long batch,
+                      ht_scan_out_t *out);
 /** Delete the key/value pair in the hashtable, freeing memory.*/
 void  ht_del(hashtable_t *ht, char *key);
 /** Iterate through all buckets with information, unsorted, performing a given function (f).
-    If the function (f) returns a falsey value, break iteration. */
+    If the function (f) returns a falsey value, break iteration. In thread-safe
+    builds the table is locked for the walk, so f must not call back into it. */
 void  ht_iter(hashtable_t *ht, int (*f)(char *, void *));
-/** Re-package hashtable with new amount of buckets.*/
+/** Re-package hashtable with new amount of buckets. With rehash_steps set the
+    move is spread over the following operations instead of done here; with
+    rehash_threads it is split across threads, giving the same chains.*/
 void  ht_rehash(hashtable_t *ht, unsigned long newsize);
 /** Free memory usage from all buckets, then free bucket array pointer and hashtable.*/
 void  free_hashtable(hashtable_t *ht);
-/** Free memory from an individual bucket (which contains a key/value pair).*/
+#ifndef HT_OPEN_ADDRESSING
+/** Live counters of the chained table (see struct hashtable). Lengths of
+    HT_STAT_LENS - 1 and up are counted together, so max_chain stops there.
+    probes, hits and misses stay 0 unless the table was made with
+    opts.probe_stats; a cache-mode table counts hits and misses anyway. */
+typedef struct ht_stats {
+  unsigned long entries;
+  unsigned long buckets;   // bucket array size, both arrays mid-rehash
+  unsigned long nonempty;  // chains with at least one entry
+  unsigned long max_chain;
+  unsigned long chains[HT_STAT_LENS];
+  unsigned long probes[HT_STAT_LENS];
+  unsigned long hits, misses;
+  unsigned long grows, shrinks;  // max_load/min_load resizes
+  unsigned long evictions, bytes;  // cache mode
+  unsigned long bloom_negatives, bloom_false_pos, bloom_bytes;
+  unsigned long trees;  // chains with a tree
+  unsigned long snap_entries, snap_bytes;  // ht_load: saved entries in use, image size
+} ht_stats_t;
+
+/** Snapshot the table's counters into st in constant time; no walk, and in
+    thread-safe builds no locks.*/
+void  ht_stats(hashtable_t *ht, ht_stats_t *st);
+#ifndef HT_THREADSAFE
+/** Write ht's entries to path, in the frozen.h image format: offsets, no
+    pointers. Values are saved as vlen(val) bytes, or as NUL-terminated
+    strings if vlen is NULL. 0 on failure. The entries are written straight
+    from the table (ht_freeze_save); only the perfect-hash index is built in
+    memory. Any backend's table can be frozen; this is the chained table's.*/
+int   ht_save(hashtable_t *ht, const char *path, unsigned long (*vlen)(void *val));
+/** Table of size buckets made with opts, holding what ht_save wrote to
+    path; NULL if that can't be mapped or opts can't be had. The file is mapped, not read: gets
+    find saved entries in place, faulting pages in as they go, so this
+    takes the same time at any size. Puts and deletes never write to the
+    mapping; a saved key that is put again moves into a heap node like any
+    new key. Values got from the mapping are read-only and live as long as
+    the table. entries in ht_stats counts both kinds; a cache budget
+    (opts.cache_*) only covers the heap nodes. Not in thread-safe builds.*/
+hashtable_t *ht_load(const char *path, unsigned long size, const ht_opts_t *opts);
+
+/** A background save: the child's pid and report pipe until
+    ht_bgsave_done reaps it, then how it went. Times are in ns. */
+typedef struct ht_bgsave {
+  pid_t pid;
+  int fd;
+  unsigned long start_ns;  // CLOCK_MONOTONIC just before the fork
+  unsigned long fork_ns;   // the parent's time in fork(), mostly page tables
+  unsigned long save_ns;   // from the fork until the child had the file in place
+  unsigned long bytes;     // size of the file written
+  int ok;
+} ht_bgsave_t;
+
+/** ht_save of ht as it is now, made by a forked child while this process
+    goes on using ht: the child has a copy-on-write image of the table
+    from the fork, so nothing has to stop, and pages the parent writes
+    meanwhile are copied by the kernel. path is replaced whole once
+    complete. Besides the pages copied for the parent's writes, the child
+    needs only ht_save's index and per-entry bookkeeping, about 60 bytes
+    an entry whatever the keys and values hold. Call from a thread that
+    isn't racing others in the table. Returns 0 if the child couldn't be
+    started; otherwise reap it with ht_bgsave_done.*/
+int   ht_bgsave(hashtable_t *ht, const char *path, unsigned long (*vlen)(void *val),
+                ht_bgsave_t *bg);
+/** 1 once bg's child has finished (then ok, bytes and save_ns are set);
+    with wait 0, 0 if it is still running.*/
+int   ht_bgsave_done(ht_bgsave_t *bg, int wait);
+#endif
+
+/** Free memory from an individual bucket (which contains a key/value pair).
+    Only for malloc'd buckets: outside -DHT_THREADSAFE a table's buckets come
+    from its slab and go back with free_hashtable.*/
 void  free_bucket(bucket_t *b);
+#endif
 
 #endif
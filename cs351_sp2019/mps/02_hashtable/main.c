@@ -3,105 +3,1011 @@
   a given trace##.txt as its driver.
 */
 
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "frozen.h"
 #include "hashtable.h"
+#include "trace.h"
+#ifndef HT_OPEN_ADDRESSING
+#include "shard.h"
+#endif
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-result" 
 
+// -c: insert with ht_put_copy instead of handing over strdup'd strings
+static int copy_puts;
+// -N: pass keys with their lengths (ht_put_n/ht_get_n/ht_del_n)
+static int len_keys;
+
 int print_iter(char *key, void *val) {
   printf("%s -> %s\n", key, (char *)val);
   return 1;
 }
 
+#ifdef HT_ROBINHOOD
+void print_ht_stats(hashtable_t *ht) {
+  unsigned long idx, max_psl=0, total_psl=0;
+  for (idx=0; idx<ht->size; idx++) {
+    total_psl += ht->slots[idx].psl;
+    if (max_psl < ht->slots[idx].psl) {
+      max_psl = ht->slots[idx].psl;
+    }
+  }
+  printf("Num buckets = %lu\n", ht->count);
+  printf("Max probe length = %lu\n", max_psl);
+  printf("Avg probe length = %0.2f\n", (float)total_psl / ht->count);
+}
+#elif defined(HT_SWISS)
 void print_ht_stats(hashtable_t *ht) {
-  bucket_t *b;
-  unsigned long idx, len, max_len=0, num_buckets=0, num_chains=0;
+  unsigned long idx, g, step, probes, max_probes=0, total_probes=0, tombstones=0;
+  unsigned long gmask = ht->size / SW_GROUP - 1;
   for (idx=0; idx<ht->size; idx++) {
-    b = ht->buckets[idx];
-    len = 0;
-    while (b) {
-      len++;
-      num_buckets++;
-      b = b->next;
+    if (ht->ctrl[idx] == SW_DELETED) {
+      tombstones++;
+    }
+    if (ht->ctrl[idx] < 0) {
+      continue;
+    }
+    // replay the triangular probe from the home group to where it landed
+    g = SW_H1(ht->slots[idx].hash) & gmask;
+    for (probes=1, step=1; g != idx / SW_GROUP; probes++) {
+      g = (g + step++) & gmask;
     }
-    if (len > 0) {
-      num_chains++;
+    total_probes += probes;
+    if (max_probes < probes) {
+      max_probes = probes;
     }
-    if (max_len < len) {
-      max_len = len;
+  }
+  printf("Num buckets = %lu\n", ht->count);
+  printf("Max probe length = %lu\n", max_probes);
+  printf("Avg probe length = %0.2f\n", (float)total_probes / ht->count);
+  printf("Slots = %lu, tombstones = %lu\n", ht->size, tombstones);
+}
+#else
+// size is the bucket array's; the flags say which optional lines apply
+static void print_stats(ht_stats_t *st, unsigned long size, int resizing,
+                        int probe_stats, int cache, int bloom) {
+  unsigned long len;
+  printf("Num buckets = %lu\n", st->entries);
+  printf("Max chain length = %lu\n", st->max_chain);
+  printf("Avg chain length = %0.2f\n", (float)(st->entries - st->snap_entries) / st->nonempty);
+  if (st->trees) {
+    printf("Tree bins = %lu\n", st->trees);
+  }
+  if (resizing) {
+    printf("Auto grows = %lu, shrinks = %lu (size %lu)\n",
+           st->grows, st->shrinks, size);
+  }
+  if (probe_stats) {
+    printf("Gets: %lu hits, %lu misses\n", st->hits, st->misses);
+    printf("Probe lengths:");
+    for (len=0; len<HT_STAT_LENS; len++) {
+      if (st->probes[len]) {
+        printf(" %lu%s:%lu", len, len == HT_STAT_LENS-1 ? "+" : "", st->probes[len]);
+      }
     }
+    printf("\n");
+  }
+  if (cache) {
+    printf("Cache: %lu hits, %lu misses, %lu evictions, %lu bytes\n",
+           st->hits, st->misses, st->evictions, st->bytes);
+  }
+  if (bloom) {
+    printf("Filter: %lu negatives, %lu false positives, %lu bytes\n",
+           st->bloom_negatives, st->bloom_false_pos, st->bloom_bytes);
+  }
+  if (st->snap_bytes) {
+    printf("Snapshot: %lu entries mapped, %lu bytes\n", st->snap_entries, st->snap_bytes);
+  }
+}
+
+// the table keeps these counters current (ht_stats), nothing is walked
+void print_ht_stats(hashtable_t *ht) {
+  ht_stats_t st;
+  ht_stats(ht, &st);
+  print_stats(&st, ht->size, ht->max_load > 0 || ht->min_load > 0, ht->probe_stats,
+              ht->cache, ht->bloom != NULL);
+}
+#endif
+
+/* -s BATCH: a cursor walk (ht_scan) runs alongside the trace, one call of
+   BATCH buckets after every directive. When a walk ends, every key that
+   was in the table for all of it must have been handed out; any that
+   wasn't is reported, so a clean run prints exactly what a plain one does.
+   scan_seen holds the keys the walk returned, scan_touched those put for
+   the first time or deleted while it ran. Whether a put is a first one is
+   told by scan_live, the keys the trace has put and not deleted, so the
+   table itself is never asked: a get would set a cache entry's reference
+   bit and count towards the stats. A cache may have evicted any key, so
+   there every put counts as a first one. */
+static unsigned long scan_batch, scan_cursor;
+static hashtable_t *scan_seen, *scan_touched, *scan_live;
+static ht_scan_out_t scan_out;
+
+static void set_add(hashtable_t *set, char *key) {
+  if (!ht_get(set, key)) {
+    ht_put(set, strdup(key), strdup(""));
+  }
+}
+
+// note a put or delete of key, before the table sees it
+static void scan_touch(char type, char *key, int cache) {
+  if (!scan_live) {
+    scan_live = make_hashtable(1024);
+  }
+  if (scan_seen && (type == 'd' || (type == 'p' && (cache || !ht_get(scan_live, key))))) {
+    set_add(scan_touched, key);
+  }
+  if (type == 'p') {
+    set_add(scan_live, key);
+  } else if (type == 'd') {
+    ht_del(scan_live, key);
+  }
+}
+
+static int scan_check(char *key, void *val) {
+  if (!ht_get(scan_touched, key) && !ht_get(scan_seen, key)) {
+    printf("Scan missed key %s\n", key);
+  }
+  return 1;
+}
+
+static void scan_step(hashtable_t *ht) {
+  unsigned long i;
+
+  if (!scan_seen) {
+    scan_seen = make_hashtable(1024);
+    scan_touched = make_hashtable(1024);
+  }
+  scan_cursor = ht_scan(ht, scan_cursor, scan_batch, &scan_out);
+  for (i = 0; i < scan_out.n; i++) {
+    set_add(scan_seen, scan_out.entries[i].key);
+  }
+  if (scan_cursor == 0) {
+    ht_iter(ht, scan_check);
+    free_hashtable(scan_seen);
+    free_hashtable(scan_touched);
+    scan_seen = scan_touched = NULL;
+  }
+}
+
+/* -Z FILE: at every i directive the table is also frozen (frozen.h), saved
+   to FILE and mapped back, and every key in the trace is looked up in the
+   mapped copy, which must find the value the table holds. The table's
+   entries are taken with ht_scan, as ht_freeze does, so no get counters or
+   cache state change. A clean run only adds the Frozen line to the stats. */
+static char *freeze_path;
+
+/* A copy of ht's entries, taken with ht_scan, to check a saved image by.*/
+static hashtable_t *held_copy(hashtable_t *ht) {
+  hashtable_t *held = make_hashtable(1024);
+  ht_scan_out_t out = { 0 };
+  unsigned long cursor = 0, i;
+
+  do {
+    cursor = ht_scan(ht, cursor, 1024, &out);
+    for (i = 0; i < out.n; i++) {
+      ht_put_n(held, memcpy(malloc(out.entries[i].klen + 1), out.entries[i].key,
+                            out.entries[i].klen + 1),
+               out.entries[i].klen, strdup(out.entries[i].val));
+    }
+  } while (cursor);
+  free(out.entries);
+  return held;
+}
+
+/* Print a disagreement for every trace key whose value in m isn't held's.*/
+static void frozen_diff(frozen_t *m, hashtable_t *held, trace_t *t, char *what) {
+  trace_op_t *op;
+  char *want, *got;
+
+  for (op = t->ops; op < t->ops + t->nops; op++) {
+    if (op->type != 'p' && op->type != 'g' && op->type != 'd') {
+      continue;
+    }
+    want = ht_get(held, op->key);
+    got = fz_get(m, op->key);
+    if (!want != !got || (want && strcmp(want, got) != 0)) {
+      printf("%s disagrees on key %s\n", what, op->key);
+    }
+  }
+}
+
+static void freeze_check(hashtable_t *ht, trace_t *t) {
+  hashtable_t *held;
+  frozen_t *f, *m = NULL;
+
+  if ((f = ht_freeze(ht, NULL))) {
+    if (fz_save(f, freeze_path)) {
+      m = fz_load(freeze_path);
+    }
+    free_frozen(f);
+  }
+  if (!m) {
+    printf("Error freezing the table to %s\n", freeze_path);
+    exit(1);
+  }
+  held = held_copy(ht);
+  frozen_diff(m, held, t, "Frozen table");
+  printf("Frozen: %lu entries, %lu bytes\n", fz_count(m), fz_bytes(m));
+  free_frozen(m);
+  free_hashtable(held);
+}
+
+#ifndef HT_OPEN_ADDRESSING
+/* -W FILE: at every i directive the table is saved to FILE (ht_save) and
+   swapped for the table ht_load maps from it, as a restarted process
+   would; the rest of the trace runs on that one, its gets reading saved
+   entries in place and its puts and deletes going over them. A -s walk
+   starts over on the new table. */
+static char *warm_path;
+
+static hashtable_t *warm_restart(hashtable_t *ht, ht_opts_t *opts) {
+  hashtable_t *loaded = NULL;
+
+  if (ht_save(ht, warm_path, NULL)) {
+    loaded = ht_load(warm_path, ht->size, opts);
+  }
+  if (!loaded) {
+    printf("Error saving the table to %s\n", warm_path);
+    exit(1);
+  }
+  free_hashtable(ht);
+  if (scan_seen) {
+    free_hashtable(scan_seen);
+    free_hashtable(scan_touched);
+    scan_seen = scan_touched = NULL;
+  }
+  scan_cursor = 0;
+  return loaded;
+}
+
+/* -B FILE: at every i directive a background save (ht_bgsave) of the table
+   to FILE starts, and the trace goes on while the child writes it. It is
+   reaped at the next i directive or the end of the trace, and the file
+   must hold just what the table held at the fork, which is kept aside to
+   compare with. A clean run only adds the Bgsave lines. */
+static char *bgsave_path;
+static ht_bgsave_t bgsave;
+static hashtable_t *bgsave_held;
+
+static void bgsave_reap(trace_t *t) {
+  frozen_t *m;
+
+  if (!bgsave_held) {
+    return;
+  }
+  ht_bgsave_done(&bgsave, 1);
+  if (!bgsave.ok || !(m = fz_load(bgsave_path))) {
+    printf("Error in the background save to %s\n", bgsave_path);
+    exit(1);
+  }
+  frozen_diff(m, bgsave_held, t, "Background save");
+  printf("Bgsave: %lu entries, %lu bytes, fork %.1f us, saved in %.3f ms\n",
+         fz_count(m), bgsave.bytes, bgsave.fork_ns / 1e3, bgsave.save_ns / 1e6);
+  free_frozen(m);
+  free_hashtable(bgsave_held);
+  bgsave_held = NULL;
+}
+
+static void bgsave_start(hashtable_t *ht) {
+  bgsave_held = held_copy(ht);
+  if (!ht_bgsave(ht, bgsave_path, NULL, &bgsave)) {
+    printf("Error starting a background save to %s\n", bgsave_path);
+    exit(1);
   }
-  printf("Num buckets = %lu\n", num_buckets);
-  printf("Max chain length = %lu\n", max_len);
-  printf("Avg chain length = %0.2f\n", (float)num_buckets / num_chains);
 }
+#endif
 
-void eval_tracefile(char *filename) {
-  FILE *infile;
-  int ht_size;
-  char buf[80], *key, *val;
+void eval_tracefile(char *filename, ht_opts_t *opts) {
+  trace_t t;
+  trace_op_t *op;
+  char *key, *val;
   hashtable_t *ht;
 
-  if ((infile = fopen(filename, "r")) == NULL) {
-    printf("Error opening tracefile %s\n", filename);
+  if (!trace_load(&t, filename)) {
     exit(1);
   }
 
-  fscanf(infile, "%d", &ht_size);
-  printf("Creating hashtable of size %d\n", ht_size);
-  ht = make_hashtable(ht_size);
+  printf("Creating hashtable of size %lu\n", t.size);
+  ht = make_hashtable_opts(t.size, opts);
 
-  while (fscanf(infile, "%s", buf) != EOF) {
-    switch(buf[0]) {
+  for (op = t.ops; op < t.ops + t.nops; op++) {
+    if (scan_batch) {
+      scan_touch(op->type, op->key, opts->cache_entries || opts->cache_bytes);
+    }
+    switch(op->type) {
     case 'p':
-      fscanf(infile, "%s", buf);
-      key = strdup(buf);
-      fscanf(infile, "%s", buf);
-      val = strdup(buf);
-      printf("Inserting %s => %s\n", key, val);
-      ht_put(ht, key, val);
+      printf("Inserting %s => %s\n", op->key, op->val);
+      if (copy_puts) {
+        ht_put_copy(ht, op->key, op->val, strlen(op->val) + 1);
+      } else {
+        key = ht_strdup(ht, op->key);
+        val = ht_strdup(ht, op->val);
+        if (len_keys) {
+          ht_put_n(ht, key, strlen(key), val);
+        } else {
+          ht_put(ht, key, val);
+        }
+      }
       break;
     case 'g':
-      fscanf(infile, "%s", buf);
-      printf("Looking up key %s\n", buf);
-      if ((val = ht_get(ht, buf))) {
+      printf("Looking up key %s\n", op->key);
+      val = len_keys ? ht_get_n(ht, op->key, strlen(op->key)) : ht_get(ht, op->key);
+      if (val) {
         printf("Found value %s\n", val);
       } else {
         printf("Key not found\n");
       }
       break;
     case 'd':
-      fscanf(infile, "%s", buf);
-      printf("Removing key %s\n", buf);
-      ht_del(ht, buf);
+      printf("Removing key %s\n", op->key);
+      if (len_keys) {
+        ht_del_n(ht, op->key, strlen(op->key));
+      } else {
+        ht_del(ht, op->key);
+      }
       break;
     case 'r':
-      fscanf(infile, "%d", &ht_size);
-      printf("Rehashing to %d buckets\n", ht_size);
-      ht_rehash(ht, ht_size);
+      printf("Rehashing to %lu buckets\n", op->num);
+      ht_rehash(ht, op->num);
       break;
     case 'i':
       printf("Printing hashtable info\n");
       print_ht_stats(ht);
+      if (freeze_path) {
+        freeze_check(ht, &t);
+      }
+#ifndef HT_OPEN_ADDRESSING
+      if (bgsave_path) {
+        bgsave_reap(&t);
+        bgsave_start(ht);
+      }
+      if (warm_path) {
+        ht = warm_restart(ht, opts);
+      }
+#endif
       break;
     default:
-      printf("Bad tracefile directive (%c)", buf[0]);
+      printf("Bad tracefile directive (%c)", op->type);
       exit(1);
     }
+    if (scan_batch) {
+      scan_step(ht);
+    }
+  }
+  if (scan_seen) {
+    free_hashtable(scan_seen);
+    free_hashtable(scan_touched);
+  }
+  if (scan_live) {
+    free_hashtable(scan_live);
   }
+#ifndef HT_OPEN_ADDRESSING
+  bgsave_reap(&t);
+#endif
+  free(scan_out.entries);
   free_hashtable(ht);
-  fclose(infile);
+  trace_free(&t);
+}
+
+/* Benchmark mode (-b ROUNDS): the trace is loaded once (trace.h) and
+   replayed ROUNDS times on a fresh table, with no output per operation.
+   Every call is timed on its own with CLOCK_MONOTONIC, so latencies include
+   one clock read (printed as timer_ns); ops/sec for "all" is from the wall
+   time of whole replays. Keys and values for puts are copied before each
+   replay starts, outside the timed calls. */
+
+// op types that get their own latency row, and their names
+static const char bench_types[] = "pgdr";
+static const char *bench_names[] = { "put", "get", "del", "rehash" };
+
+static inline unsigned long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static int cmp_lat(const void *a, const void *b) {
+  unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void print_lat(const char *name, unsigned long *lat, unsigned long n,
+                      double ops_per_sec) {
+  unsigned long i, sum = 0;
+
+  if (n == 0)
+    return;
+  qsort(lat, n, sizeof(unsigned long), cmp_lat);
+  for (i = 0; i < n; i++)
+    sum += lat[i];
+  if (ops_per_sec == 0)
+    ops_per_sec = n / (sum / 1e9);
+  printf("%-6s %10lu %12.0f %8.1f %7lu %7lu %7lu %7lu %9lu\n", name, n, ops_per_sec,
+         (double)sum / n, lat[n / 2], lat[n * 9 / 10], lat[n * 99 / 100],
+         lat[n * 999 / 1000], lat[n - 1]);
+}
+
+void bench_tracefile(char *filename, ht_opts_t *opts, unsigned long rounds) {
+  unsigned long size, nops, i, r, t, t0, t1, wall = 0, timer, all_n = 0;
+  unsigned long nlat[4] = { 0 };
+  unsigned long *lat[4], *all;
+  trace_t trace;
+  trace_op_t *ops;
+  char **keys, **vals;
+  unsigned long *lens;
+  hashtable_t *ht;
+
+  if (!trace_load(&trace, filename)) {
+    exit(1);
+  }
+  // stats directives aren't timed
+  size = trace.size;
+  ops = trace.ops;
+  for (i = nops = 0; i < trace.nops; i++) {
+    if (ops[i].type == 'i') {
+      continue;
+    }
+    if (!ops[i].type || !strchr(bench_types, ops[i].type)) {
+      printf("Bad tracefile directive (%c)", ops[i].type);
+      exit(1);
+    }
+    ops[nops++] = ops[i];
+  }
+  keys = malloc(nops * sizeof(char *) + 1);
+  vals = malloc(nops * sizeof(char *) + 1);
+  // with -N key lengths are known up front, as they would be to a caller
+  lens = malloc(nops * sizeof(unsigned long) + 1);
+  for (i = 0; i < nops; i++)
+    lens[i] = ops[i].key ? strlen(ops[i].key) : 0;
+
+  for (t = 0; t < 4; t++) {
+    for (i = 0; i < nops; i++)
+      nlat[t] += ops[i].type == bench_types[t];
+    lat[t] = malloc(nlat[t] * rounds * sizeof(unsigned long) + 1);
+    nlat[t] = 0;
+  }
+  all = malloc(nops * rounds * sizeof(unsigned long) + 1);
+
+  // cost of the clock read folded into every latency
+  t0 = now_ns();
+  for (i = 0; i < 1000; i++)
+    t1 = now_ns();
+  timer = (t1 - t0) / 1000;
+
+  for (r = 0; r < rounds; r++) {
+    ht = make_hashtable_opts(size, opts);
+    if (!copy_puts) {
+      for (i = 0; i < nops; i++) {
+        if (ops[i].type == 'p') {
+          keys[i] = ht_strdup(ht, ops[i].key);
+          vals[i] = ht_strdup(ht, ops[i].val);
+        }
+      }
+    }
+
+    t0 = now_ns();
+    wall -= t0;
+    for (i = 0; i < nops; i++) {
+      trace_op_t *op = &ops[i];
+      switch (op->type) {
+      case 'p':
+        if (copy_puts)
+          ht_put_copy(ht, op->key, op->val, strlen(op->val) + 1);
+        else if (len_keys)
+          ht_put_n(ht, keys[i], lens[i], vals[i]);
+        else
+          ht_put(ht, keys[i], vals[i]);
+        t = 0;
+        break;
+      case 'g':
+        if (len_keys)
+          ht_get_n(ht, op->key, lens[i]);
+        else
+          ht_get(ht, op->key);
+        t = 1;
+        break;
+      case 'd':
+        if (len_keys)
+          ht_del_n(ht, op->key, lens[i]);
+        else
+          ht_del(ht, op->key);
+        t = 2;
+        break;
+      default:
+        ht_rehash(ht, op->num);
+        t = 3;
+      }
+      t1 = now_ns();
+      lat[t][nlat[t]++] = all[all_n++] = t1 - t0;
+      t0 = t1;
+    }
+    wall += t0;
+    free_hashtable(ht);
+  }
+
+  // one header comment line, then whitespace-separated columns
+  printf("# trace=%s rounds=%lu ops=%lu timer_ns=%lu\n", filename, rounds, nops, timer);
+  printf("%-6s %10s %12s %8s %7s %7s %7s %7s %9s\n", "op", "count", "ops_per_sec",
+         "mean_ns", "p50_ns", "p90_ns", "p99_ns", "p999_ns", "max_ns");
+  print_lat("all", all, all_n, all_n / (wall / 1e9));
+  for (t = 0; t < 4; t++)
+    print_lat(bench_names[t], lat[t], nlat[t], 0);
+
+  for (t = 0; t < 4; t++)
+    free(lat[t]);
+  free(all);
+  trace_free(&trace);
+  free(keys);
+  free(vals);
+  free(lens);
+}
+
+#ifndef HT_OPEN_ADDRESSING
+/* -S BITS: the trace runs on a sharded table (shard.h) of 2^BITS shards,
+   through the locking sh_* calls. With -j WORKERS it is replayed by that
+   many threads instead, worker w owning the shards i with
+   i % WORKERS == w: it replays, in trace order, the operations on keys of
+   its shards, and every r (rehashing its own shards) and i (recording its
+   shards' stats). As no two workers share a shard they call the ht_*
+   functions on them directly, without locks, and keys keep their order.
+   Output is printed once all are done, the same as a single-threaded run;
+   keys and values go in each shard's arena so found values outlive the
+   replay. With -b ROUNDS the replay is timed for 1, 2, 4, ... WORKERS
+   workers instead; copies of keys and values are made before the clock
+   starts, as in bench_tracefile. */
+static int shard;
+static unsigned int shard_bits;
+static unsigned long shard_workers;
+
+// one worker's shards (or all of them) at an i directive
+typedef struct sh_snap {
+  ht_stats_t st;
+  unsigned long size, min, max;  // total buckets; fewest, most entries
+} sh_snap_t;
+
+typedef struct sh_worker {
+  pthread_t tid;
+  unsigned long id;
+  unsigned long *ops, n;  // indices of the ops it replays, in trace order
+} sh_worker_t;
+
+static sharded_t *sh;
+static trace_op_t *sh_ops;
+static unsigned long *sh_route, *sh_lens, sh_nworkers;
+static char **sh_keys, **sh_vals;  // -b: per-op copies for the puts
+static void **sh_found;            // what each get found
+static sh_snap_t *sh_snaps;        // [n-th i directive * workers + worker]
+static pthread_barrier_t sh_start;
+
+// shard and key length of every op, computed once
+static void sh_route_ops(unsigned long nops) {
+  unsigned long i;
+
+  sh_route = calloc(nops + 1, sizeof(unsigned long));
+  sh_lens = calloc(nops + 1, sizeof(unsigned long));
+  for (i = 0; i < nops; i++) {
+    if (sh_ops[i].key) {
+      sh_lens[i] = strlen(sh_ops[i].key);
+      sh_route[i] = sh_index(sh, sh_ops[i].key, sh_lens[i]);
+    }
+  }
+}
+
+static void sh_snap(unsigned long first, unsigned long step, sh_snap_t *snap) {
+  ht_stats_t st;
+  hashtable_t *ht;
+  unsigned long s;
+
+  memset(snap, 0, sizeof(sh_snap_t));
+  snap->min = ULONG_MAX;
+  for (s = first; s < sh->nshards; s += step) {
+    ht = sh_table(sh, s);
+    ht_stats(ht, &st);
+    sh_stats_add(&snap->st, &st);
+    snap->size += ht->size;
+    if (snap->min > st.entries)
+      snap->min = st.entries;
+    if (snap->max < st.entries)
+      snap->max = st.entries;
+  }
+}
+
+static void print_sh_stats(sh_snap_t *snap, ht_opts_t *opts) {
+  print_stats(&snap->st, snap->size, opts->max_load > 0 || opts->min_load > 0,
+              opts->probe_stats, opts->cache_entries || opts->cache_bytes,
+              opts->bloom_counters > 0);
+  printf("Shards = %lu, entries per shard %lu to %lu\n", sh->nshards,
+         snap->min, snap->max);
+}
+
+static void *sh_replay(void *arg) {
+  sh_worker_t *w = arg;
+  unsigned long k, i, s, ni = 0;
+  trace_op_t *op;
+  hashtable_t *ht;
+  void *val;
+
+  pthread_barrier_wait(&sh_start);
+  for (k = 0; k < w->n; k++) {
+    i = w->ops[k];
+    op = &sh_ops[i];
+    ht = sh_table(sh, sh_route[i]);
+    switch (op->type) {
+    case 'p':
+      if (sh_keys)
+        ht_put_n(ht, sh_keys[i], sh_lens[i], sh_vals[i]);
+      else
+        ht_put_n(ht, ht_strdup(ht, op->key), sh_lens[i], ht_strdup(ht, op->val));
+      break;
+    case 'g':
+      val = ht_get_n(ht, op->key, sh_lens[i]);
+      if (sh_found)
+        sh_found[i] = val;
+      break;
+    case 'd':
+      ht_del_n(ht, op->key, sh_lens[i]);
+      break;
+    case 'r':
+      for (s = w->id; s < sh->nshards; s += sh_nworkers)
+        ht_rehash(sh_table(sh, s), sh_shard_size(sh, op->num));
+      break;
+    case 'i':
+      if (sh_snaps)
+        sh_snap(w->id, sh_nworkers, &sh_snaps[ni++ * sh_nworkers + w->id]);
+      break;
+    }
+  }
+  return NULL;
+}
+
+// split the ops between n workers (at most one per shard), each getting
+// those on its own shards and every r and i
+static sh_worker_t *sh_deal(unsigned long nops, unsigned long n) {
+  sh_worker_t *workers;
+  unsigned long i, w;
+
+  sh_nworkers = n < sh->nshards ? n : sh->nshards;
+  workers = calloc(sh_nworkers, sizeof(sh_worker_t));
+  for (w = 0; w < sh_nworkers; w++) {
+    workers[w].id = w;
+    for (i = 0; i < nops; i++)
+      workers[w].n += !sh_ops[i].key || sh_route[i] % sh_nworkers == w;
+    workers[w].ops = malloc(workers[w].n * sizeof(unsigned long) + 1);
+    workers[w].n = 0;
+  }
+  for (i = 0; i < nops; i++) {
+    for (w = 0; w < sh_nworkers; w++) {
+      if (!sh_ops[i].key || sh_route[i] % sh_nworkers == w)
+        workers[w].ops[workers[w].n++] = i;
+    }
+  }
+  return workers;
+}
+
+// run the workers to the end; returns the wall time in ns
+static unsigned long sh_run(sh_worker_t *workers) {
+  unsigned long w, t;
+
+  pthread_barrier_init(&sh_start, NULL, sh_nworkers + 1);
+  for (w = 0; w < sh_nworkers; w++)
+    pthread_create(&workers[w].tid, NULL, sh_replay, &workers[w]);
+  // clock first: the workers can finish before this thread runs again
+  t = now_ns();
+  pthread_barrier_wait(&sh_start);
+  for (w = 0; w < sh_nworkers; w++)
+    pthread_join(workers[w].tid, NULL);
+  t = now_ns() - t;
+  pthread_barrier_destroy(&sh_start);
+  return t;
+}
+
+static void sh_free_workers(sh_worker_t *workers) {
+  for (unsigned long w = 0; w < sh_nworkers; w++)
+    free(workers[w].ops);
+  free(workers);
+}
+
+void eval_sharded(char *filename, ht_opts_t *opts) {
+  unsigned long i, w, ni = 0;
+  sh_worker_t *workers = NULL;
+  ht_opts_t shopts = *opts;
+  trace_t t;
+  trace_op_t *op;
+  sh_snap_t snap, *part;
+  hashtable_t *ht;
+  void *val;
+
+  if (!trace_load(&t, filename)) {
+    exit(1);
+  }
+
+  printf("Creating hashtable of size %lu\n", t.size);
+  if (shard_workers) {
+    shopts.arena = 1;
+  }
+  sh = make_sharded(shard_bits, t.size, &shopts);
+  sh_ops = t.ops;
+  sh_route_ops(t.nops);
+
+  if (shard_workers) {
+    sh_found = calloc(t.nops + 1, sizeof(void *));
+    for (i = 0; i < t.nops; i++)
+      ni += t.ops[i].type == 'i';
+    workers = sh_deal(t.nops, shard_workers);
+    sh_snaps = calloc(ni * sh_nworkers + 1, sizeof(sh_snap_t));
+    sh_run(workers);
+    ni = 0;
+  }
+
+  for (i = 0; i < t.nops; i++) {
+    op = &t.ops[i];
+    ht = sh_table(sh, sh_route[i]);
+    switch(op->type) {
+    case 'p':
+      printf("Inserting %s => %s\n", op->key, op->val);
+      if (!shard_workers) {
+        sh_put_n(sh, ht_strdup(ht, op->key), sh_lens[i], ht_strdup(ht, op->val));
+      }
+      break;
+    case 'g':
+      printf("Looking up key %s\n", op->key);
+      val = shard_workers ? sh_found[i] : sh_get_n(sh, op->key, sh_lens[i]);
+      if (val) {
+        printf("Found value %s\n", (char *)val);
+      } else {
+        printf("Key not found\n");
+      }
+      break;
+    case 'd':
+      printf("Removing key %s\n", op->key);
+      if (!shard_workers) {
+        sh_del_n(sh, op->key, sh_lens[i]);
+      }
+      break;
+    case 'r':
+      printf("Rehashing to %lu buckets\n", op->num);
+      if (!shard_workers) {
+        sh_rehash(sh, op->num);
+      }
+      break;
+    case 'i':
+      printf("Printing hashtable info\n");
+      if (!shard_workers) {
+        sh_snap(0, 1, &snap);
+      } else {
+        // the workers' shards are disjoint: add their parts up
+        memset(&snap, 0, sizeof(sh_snap_t));
+        snap.min = ULONG_MAX;
+        for (w = 0; w < sh_nworkers; w++) {
+          part = &sh_snaps[ni * sh_nworkers + w];
+          sh_stats_add(&snap.st, &part->st);
+          snap.size += part->size;
+          if (snap.min > part->min)
+            snap.min = part->min;
+          if (snap.max < part->max)
+            snap.max = part->max;
+        }
+        ni++;
+      }
+      print_sh_stats(&snap, opts);
+      break;
+    default:
+      printf("Bad tracefile directive (%c)", op->type);
+      exit(1);
+    }
+  }
+
+  if (workers) {
+    sh_free_workers(workers);
+  }
+  free(sh_found);
+  free(sh_snaps);
+  free(sh_route);
+  free(sh_lens);
+  free_sharded(sh);
+  trace_free(&t);
+}
+
+void bench_sharded(char *filename, ht_opts_t *opts, unsigned long rounds) {
+  unsigned long nops, i, r, n, maxn, wall;
+  sh_worker_t *workers;
+  trace_t trace;
+  hashtable_t *ht;
+  double rate;
+
+  if (!trace_load(&trace, filename)) {
+    exit(1);
+  }
+  // stats directives aren't timed
+  sh_ops = trace.ops;
+  for (i = nops = 0; i < trace.nops; i++) {
+    if (sh_ops[i].type == 'i') {
+      continue;
+    }
+    if (!sh_ops[i].type || !strchr(bench_types, sh_ops[i].type)) {
+      printf("Bad tracefile directive (%c)", sh_ops[i].type);
+      exit(1);
+    }
+    sh_ops[nops++] = sh_ops[i];
+  }
+  sh_keys = calloc(nops + 1, sizeof(char *));
+  sh_vals = calloc(nops + 1, sizeof(char *));
+
+  maxn = shard_workers ? shard_workers : 1;
+  printf("# trace=%s rounds=%lu ops=%lu shards=%lu\n", filename, rounds, nops,
+         1UL << shard_bits);
+  printf("%-8s %14s %14s\n", "threads", "ops/sec", "ops/sec/thread");
+  for (n = 1; ; n = n * 2 < maxn ? n * 2 : maxn) {
+    workers = NULL;
+    for (r = wall = 0; r < rounds; r++) {
+      sh = make_sharded(shard_bits, trace.size, opts);
+      if (!sh_route) {
+        sh_route_ops(nops);
+      }
+      if (!workers) {
+        workers = sh_deal(nops, n);
+      }
+      for (i = 0; i < nops; i++) {
+        if (sh_ops[i].type == 'p') {
+          ht = sh_table(sh, sh_route[i]);
+          sh_keys[i] = ht_strdup(ht, sh_ops[i].key);
+          sh_vals[i] = ht_strdup(ht, sh_ops[i].val);
+        }
+      }
+      wall += sh_run(workers);
+      free_sharded(sh);
+    }
+    rate = nops * rounds / (wall / 1e9);
+    printf("%-8lu %14.0f %14.0f\n", sh_nworkers, rate, rate / sh_nworkers);
+    sh_free_workers(workers);
+    if (n == maxn || sh_nworkers < n)
+      break;
+  }
+
+  free(sh_keys);
+  free(sh_vals);
+  free(sh_route);
+  free(sh_lens);
+  trace_free(&trace);
+}
+#endif
+
+void usage(char *prog) {
+  printf("Usage: %s [-r STEPS] [-l MAX,MIN] [-H NAME[:SEED]] [-t THREADS] [-a] [-c] [-N] [-s BATCH] [-p] [-C ENTRIES[,BYTES]] [-F COUNTERS] [-S BITS [-j WORKERS]] [-Z FILE] [-W FILE] [-B FILE] [-b ROUNDS] TRACEFILE_NAME\n", prog);
+  printf("  -r STEPS    rehash incrementally, moving STEPS buckets per operation\n");
+  printf("  -l MAX,MIN  grow/shrink automatically at these entries per bucket\n");
+  printf("  -H NAME     hash function: djb, fnv1a, wy, xx64 or sip, optionally seeded\n");
+  printf("  -t THREADS  split rehashes of large tables across THREADS threads\n");
+  printf("  -a          keep keys and values in a table-owned arena\n");
+  printf("  -c          copy keys and values into the table (ht_put_copy)\n");
+  printf("  -N          pass key lengths (ht_put_n/ht_get_n/ht_del_n)\n");
+  printf("  -s BATCH    check a cursor walk (ht_scan) of BATCH buckets per directive\n");
+  printf("  -p          count get hits/misses and probe lengths, shown with the stats\n");
+  printf("  -C ENTRIES[,BYTES]  bounded cache, not with -a: evict past ENTRIES entries or BYTES bytes\n");
+  printf("  -F COUNTERS counting Bloom filter, COUNTERS per bucket, in front of gets\n");
+  printf("  -S BITS     split the table into 2^BITS shards (chained table only)\n");
+  printf("  -j WORKERS  with -S, replay on WORKERS threads, each owning its shards\n");
+  printf("  -Z FILE     check a frozen copy (ht_freeze), saved to FILE, at every info\n");
+  printf("  -W FILE     save to FILE (ht_save) and go on with ht_load's table at every info\n");
+  printf("  -B FILE     save to FILE in the background (ht_bgsave) at every info\n");
+  printf("  -b ROUNDS   replay quietly ROUNDS times, print throughput and latencies\n");
+  exit(0);
 }
 
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    printf("Usage: %s TRACEFILE_NAME\n", argv[0]);
-    exit(0);
+  ht_opts_t opts = { 0 };
+  unsigned long rounds = 0;
+  char *seed;
+  int c;
+
+  while ((c = getopt(argc, argv, "r:l:H:t:acNs:pC:F:S:j:Z:W:B:b:")) != -1) {
+    switch (c) {
+    case 'r':
+      opts.rehash_steps = strtoul(optarg, NULL, 10);
+      break;
+    case 'l':
+      if (sscanf(optarg, "%lf,%lf", &opts.max_load, &opts.min_load) < 1) {
+        usage(argv[0]);
+      }
+      break;
+    case 'H':
+      if ((seed = strchr(optarg, ':'))) {
+        *seed++ = '\0';
+        opts.hash_seed = strtoul(seed, NULL, 0);
+      }
+      if (!(opts.hash_fn = hash_by_name(optarg))) {
+        usage(argv[0]);
+      }
+      break;
+    case 't':
+      opts.rehash_threads = strtoul(optarg, NULL, 10);
+      break;
+    case 'a':
+      opts.arena = 1;
+      break;
+    case 'c':
+      copy_puts = 1;
+      break;
+    case 'N':
+      len_keys = 1;
+      break;
+    case 's':
+      scan_batch = strtoul(optarg, NULL, 10);
+      break;
+    case 'p':
+      opts.probe_stats = 1;
+      break;
+#ifndef HT_OPEN_ADDRESSING
+    case 'C':
+      if (sscanf(optarg, "%lu,%lu", &opts.cache_entries, &opts.cache_bytes) < 1) {
+        usage(argv[0]);
+      }
+      break;
+    case 'F':
+      opts.bloom_counters = strtoul(optarg, NULL, 10);
+      break;
+    case 'S':
+      if ((shard_bits = strtoul(optarg, NULL, 10)) > SH_MAX_BITS) {
+        usage(argv[0]);
+      }
+      shard = 1;
+      break;
+    case 'j':
+      shard_workers = strtoul(optarg, NULL, 10);
+      break;
+    case 'W':
+      warm_path = optarg;
+      break;
+    case 'B':
+      bgsave_path = optarg;
+      break;
+#endif
+    case 'Z':
+      freeze_path = optarg;
+      break;
+    case 'b':
+      if ((rounds = strtoul(optarg, NULL, 10)) == 0) {
+        usage(argv[0]);
+      }
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind >= argc || (freeze_path && rounds)) {
+    usage(argv[0]);
+  }
+#ifndef HT_OPEN_ADDRESSING
+  // an arena can't give evicted entries back (see ht_opts_t)
+  if ((shard_workers && !shard) || ((warm_path || bgsave_path) && (shard || rounds)) ||
+      (opts.arena && (opts.cache_entries || opts.cache_bytes))) {
+    usage(argv[0]);
+  }
+  if (shard) {
+    if (copy_puts || scan_batch || freeze_path) {
+      usage(argv[0]);
+    }
+    if (rounds) {
+      bench_sharded(argv[optind], &opts, rounds);
+    } else {
+      eval_sharded(argv[optind], &opts);
+    }
+    return 0;
+  }
+#endif
+  if (rounds) {
+    bench_tracefile(argv[optind], &opts, rounds);
+  } else {
+    eval_tracefile(argv[optind], &opts);
   }
-  eval_tracefile(argv[1]);
   return 0;
 }
 
@@ -0,0 +1,208 @@
+/**
+  Multi-threaded trace replay for the thread-safe table (-DHT_THREADSAFE).
+  The p/g/d/r operations of a trace are dealt round-robin to N threads, each
+  thread replays its share ROUNDS times, and ops/sec is reported for 1, 2, 4,
+  ... up to MAXTHREADS threads.
+
+  Usage: mtdriver [-t MAXTHREADS] [-n ROUNDS] [-g] [-G] [-i] [-s STRIPES] [-r STEPS]
+                  [-l MAX,MIN] TRACEFILE_NAME
+    -g  funnel every operation through one global mutex, for comparison
+    -G  read-only: load the trace's puts first, then time only its gets
+    -i  as -G, but the gets run while an incremental rehash (to twice the
+        size, -r STEPS or 1) is pending, which they must not serialize on
+    -s  number of lock stripes (default HT_STRIPES)
+    -r, -l  incremental rehash / load-factor resizing, as in the trace driver
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hashtable.h"
+#include "epoch.h"
+#include "trace.h"
+
+typedef struct worker {
+  pthread_t tid;
+  int id;
+} worker_t;
+
+static trace_t trace;
+static trace_op_t *ops;
+static unsigned long nops, ht_size;
+static hashtable_t *ht;
+static ht_opts_t opts;
+static int nthreads, rounds = 10, global_lock, read_only, migrating;
+static pthread_mutex_t big_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t start;
+
+// the trace's operations, minus the stats directives
+static void load_tracefile(char *filename) {
+  unsigned long i;
+
+  if (!trace_load(&trace, filename))
+    exit(1);
+  ht_size = trace.size;
+  ops = trace.ops;
+  for (i = 0; i < trace.nops; i++) {
+    if (!ops[i].type || !strchr("pgdr", ops[i].type)) {
+      if (ops[i].type == 'i')
+        continue;
+      printf("Bad tracefile directive (%c)", ops[i].type);
+      exit(1);
+    }
+    ops[nops++] = ops[i];
+  }
+}
+
+static void run_op(trace_op_t *op) {
+  switch (op->type) {
+  case 'p':
+    ht_put(ht, strdup(op->key), strdup(op->val));
+    break;
+  case 'g':
+    ht_get(ht, op->key);
+    break;
+  case 'd':
+    ht_del(ht, op->key);
+    break;
+  case 'r':
+    ht_rehash(ht, op->num);
+    break;
+  }
+}
+
+static void *replay(void *arg) {
+  worker_t *w = arg;
+  unsigned long i;
+  int r;
+
+  pthread_barrier_wait(&start);
+  for (r = 0; r < rounds; r++) {
+    for (i = w->id; i < nops; i += nthreads) {
+      if (read_only && ops[i].type != 'g')
+        continue;
+      if (global_lock) {
+        pthread_mutex_lock(&big_lock);
+        run_op(&ops[i]);
+        pthread_mutex_unlock(&big_lock);
+      } else {
+        run_op(&ops[i]);
+      }
+    }
+  }
+  return NULL;
+}
+
+// operations one round replays
+static unsigned long timed_ops(void) {
+  unsigned long i, n = 0;
+  if (!read_only)
+    return nops;
+  for (i = 0; i < nops; i++)
+    n += ops[i].type == 'g';
+  return n;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// one timed replay with n threads; returns ops/sec
+static double run(int n) {
+  worker_t *workers = calloc(n, sizeof(worker_t));
+  unsigned long j;
+  double t;
+  int i;
+
+  nthreads = n;
+  ht = make_hashtable_opts(ht_size, &opts);
+  if (read_only) {
+    for (j = 0; j < nops; j++) {
+      if (ops[j].type == 'p')
+        run_op(&ops[j]);
+    }
+  }
+  if (migrating)
+    ht_rehash(ht, ht->size * 2);
+  pthread_barrier_init(&start, NULL, n + 1);
+  for (i = 0; i < n; i++) {
+    workers[i].id = i;
+    pthread_create(&workers[i].tid, NULL, replay, &workers[i]);
+  }
+  // start the clock first: on a busy box the workers can finish before
+  // this thread is scheduled again after the barrier
+  t = now();
+  pthread_barrier_wait(&start);
+  for (i = 0; i < n; i++)
+    pthread_join(workers[i].tid, NULL);
+  t = now() - t;
+
+  // workers are gone: whatever they retired can go now
+  epoch_quiesce();
+  pthread_barrier_destroy(&start);
+  free_hashtable(ht);
+  free(workers);
+  return (double)timed_ops() * rounds / t;
+}
+
+int main(int argc, char *argv[]) {
+  int maxthreads = sysconf(_SC_NPROCESSORS_ONLN), n, c;
+  double rate;
+
+  while ((c = getopt(argc, argv, "t:n:gGis:r:l:")) != -1) {
+    switch (c) {
+    case 't':
+      maxthreads = atoi(optarg);
+      break;
+    case 'n':
+      rounds = atoi(optarg);
+      break;
+    case 'g':
+      global_lock = 1;
+      break;
+    case 'G':
+      read_only = 1;
+      break;
+    case 'i':
+      read_only = migrating = 1;
+      break;
+    case 's':
+      opts.lock_stripes = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      opts.rehash_steps = strtoul(optarg, NULL, 10);
+      break;
+    case 'l':
+      sscanf(optarg, "%lf,%lf", &opts.max_load, &opts.min_load);
+      break;
+    default:
+      optind = argc;
+    }
+  }
+  if (optind >= argc) {
+    printf("Usage: %s [-t MAXTHREADS] [-n ROUNDS] [-g] [-G] [-i] [-s STRIPES] [-r STEPS] [-l MAX,MIN] "
+           "TRACEFILE_NAME\n", argv[0]);
+    exit(0);
+  }
+
+  if (maxthreads < 1)
+    maxthreads = 1;
+  if (migrating && !opts.rehash_steps)
+    opts.rehash_steps = 1;
+  load_tracefile(argv[optind]);
+  printf("%-8s %14s %14s\n", "threads", "ops/sec", "ops/sec/thread");
+  for (n = 1; ; n = n * 2 < maxthreads ? n * 2 : maxthreads) {
+    rate = run(n);
+    printf("%-8d %14.0f %14.0f\n", n, rate, rate / n);
+    if (n == maxthreads)
+      break;
+  }
+
+  trace_free(&trace);
+  return 0;
+}
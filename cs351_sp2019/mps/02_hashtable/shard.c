@@ -0,0 +1,125 @@
+#include "shard.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Fibonacci hashing: multiply by 2^64 / phi so the top bits depend on every
+// bit of the hash; hash_djb alone leaves them zero for short keys
+#define SH_MIX 0x9e3779b97f4a7c15UL
+
+sharded_t *make_sharded(unsigned int bits, unsigned long size, const ht_opts_t *opts) {
+
+  sharded_t *sh = calloc(1, sizeof(sharded_t));
+  ht_opts_t shopts = { 0 };
+  sh->bits = bits < SH_MAX_BITS ? bits : SH_MAX_BITS;
+  sh->nshards = 1UL << sh->bits;
+  sh->shards = aligned_alloc(sizeof(sh_shard_t), sh->nshards * sizeof(sh_shard_t));
+  if (opts) {
+    sh->hashfn = opts->hash_fn;
+    sh->seed = opts->hash_seed;
+    shopts = *opts;
+  }
+  // a cache budget is the whole table's: each shard gets its share
+  if (shopts.cache_entries)
+    shopts.cache_entries = sh_shard_size(sh, shopts.cache_entries);
+  if (shopts.cache_bytes)
+    shopts.cache_bytes = sh_shard_size(sh, shopts.cache_bytes);
+  for (unsigned long i = 0; i < sh->nshards; i++) {
+    pthread_mutex_init(&sh->shards[i].lock, NULL);
+    sh->shards[i].ht = make_hashtable_opts(sh_shard_size(sh, size), &shopts);
+  }
+  return sh;
+}
+
+unsigned long sh_index(sharded_t *sh, char *key, unsigned long len) {
+  unsigned long h = sh->hashfn ? sh->hashfn(key, len, sh->seed) : hash_djb(key, len, 0);
+  // shift by 64 is undefined: one shard takes everything
+  return sh->bits ? (h * SH_MIX) >> (64 - sh->bits) : 0;
+}
+
+void sh_put_n(sharded_t *sh, char *key, unsigned long len, void *val) {
+  sh_shard_t *s = &sh->shards[sh_index(sh, key, len)];
+  pthread_mutex_lock(&s->lock);
+  ht_put_n(s->ht, key, len, val);
+  pthread_mutex_unlock(&s->lock);
+}
+
+void *sh_get_n(sharded_t *sh, char *key, unsigned long len) {
+  sh_shard_t *s = &sh->shards[sh_index(sh, key, len)];
+  void *val;
+  pthread_mutex_lock(&s->lock);
+  val = ht_get_n(s->ht, key, len);
+  pthread_mutex_unlock(&s->lock);
+  return val;
+}
+
+void sh_del_n(sharded_t *sh, char *key, unsigned long len) {
+  sh_shard_t *s = &sh->shards[sh_index(sh, key, len)];
+  pthread_mutex_lock(&s->lock);
+  ht_del_n(s->ht, key, len);
+  pthread_mutex_unlock(&s->lock);
+}
+
+void sh_put(sharded_t *sh, char *key, void *val) {
+  sh_put_n(sh, key, strlen(key), val);
+}
+
+void *sh_get(sharded_t *sh, char *key) {
+  return sh_get_n(sh, key, strlen(key));
+}
+
+void sh_del(sharded_t *sh, char *key) {
+  sh_del_n(sh, key, strlen(key));
+}
+
+void sh_rehash(sharded_t *sh, unsigned long newsize) {
+  for (unsigned long i = 0; i < sh->nshards; i++) {
+    pthread_mutex_lock(&sh->shards[i].lock);
+    ht_rehash(sh->shards[i].ht, sh_shard_size(sh, newsize));
+    pthread_mutex_unlock(&sh->shards[i].lock);
+  }
+}
+
+void sh_stats_add(ht_stats_t *sum, const ht_stats_t *st) {
+  sum->entries += st->entries;
+  sum->buckets += st->buckets;
+  sum->nonempty += st->nonempty;
+  if (sum->max_chain < st->max_chain)
+    sum->max_chain = st->max_chain;
+  for (unsigned long l = 0; l < HT_STAT_LENS; l++) {
+    sum->chains[l] += st->chains[l];
+    sum->probes[l] += st->probes[l];
+  }
+  sum->hits += st->hits;
+  sum->misses += st->misses;
+  sum->grows += st->grows;
+  sum->shrinks += st->shrinks;
+  sum->evictions += st->evictions;
+  sum->bytes += st->bytes;
+  sum->bloom_negatives += st->bloom_negatives;
+  sum->bloom_false_pos += st->bloom_false_pos;
+  sum->bloom_bytes += st->bloom_bytes;
+  sum->trees += st->trees;
+  sum->snap_entries += st->snap_entries;
+  sum->snap_bytes += st->snap_bytes;
+}
+
+void sh_stats(sharded_t *sh, ht_stats_t *st) {
+  ht_stats_t one;
+
+  memset(st, 0, sizeof(ht_stats_t));
+  for (unsigned long i = 0; i < sh->nshards; i++) {
+    pthread_mutex_lock(&sh->shards[i].lock);
+    ht_stats(sh->shards[i].ht, &one);
+    pthread_mutex_unlock(&sh->shards[i].lock);
+    sh_stats_add(st, &one);
+  }
+}
+
+void free_sharded(sharded_t *sh) {
+  for (unsigned long i = 0; i < sh->nshards; i++) {
+    free_hashtable(sh->shards[i].ht);
+    pthread_mutex_destroy(&sh->shards[i].lock);
+  }
+  free(sh->shards);
+  free(sh);
+}
@@ -0,0 +1,76 @@
+#ifndef SHARD_T
+#define SHARD_T
+
+#include <pthread.h>
+#include "hashtable.h"
+
+/**
+ * Sharded front-end over the chained table: 2^bits independent hashtables,
+ * each key living in the shard picked by the top bits of its (mixed) hash.
+ * Every shard has its own lock, resizes on its own and keeps its own stats,
+ * so neither lock contention nor a resize reaches past one shard.
+ *
+ * The sh_* calls lock the key's shard and may come from any thread. A
+ * thread that is the only one using a shard can instead call the ht_*
+ * functions on sh_table directly, with no locking at all; that is also the
+ * only way to use opts.arena (ht_strdup on that shard's table).
+ */
+
+/** A shard's lock and table, padded to a cache line. */
+typedef union sh_shard {
+  struct {
+    pthread_mutex_t lock;
+    hashtable_t *ht;
+  };
+  char pad[64];
+} sh_shard_t;
+
+typedef struct sharded {
+  unsigned int bits;
+  unsigned long nshards;  // 1 << bits
+  sh_shard_t *shards;
+  ht_hash_fn hashfn;      // the tables' hash, NULL for hash_djb
+  unsigned long seed;
+} sharded_t;
+
+#define SH_MAX_BITS 16
+
+/** 2^bits shards, each a make_hashtable_opts table of sh_shard_size(size)
+    buckets, so the shards together start with about size buckets. A cache
+    budget in opts is split between the shards the same way. */
+sharded_t *make_sharded(unsigned int bits, unsigned long size, const ht_opts_t *opts);
+
+/** Buckets per shard when the whole table should have size. */
+static inline unsigned long sh_shard_size(sharded_t *sh, unsigned long size) {
+  return size >> sh->bits ? size >> sh->bits : 1;
+}
+
+/** Shard holding the len bytes at key. */
+unsigned long sh_index(sharded_t *sh, char *key, unsigned long len);
+
+static inline hashtable_t *sh_table(sharded_t *sh, unsigned long i) {
+  return sh->shards[i].ht;
+}
+
+/** ht_put / ht_get / ht_del on the key's shard, under its lock. A value
+    from sh_get stays valid until another thread deletes or overwrites its
+    key.*/
+void  sh_put(sharded_t *sh, char *key, void *val);
+void *sh_get(sharded_t *sh, char *key);
+void  sh_del(sharded_t *sh, char *key);
+void  sh_put_n(sharded_t *sh, char *key, unsigned long len, void *val);
+void *sh_get_n(sharded_t *sh, char *key, unsigned long len);
+void  sh_del_n(sharded_t *sh, char *key, unsigned long len);
+
+/** Rehash every shard to sh_shard_size(newsize), one shard locked at a time.*/
+void  sh_rehash(sharded_t *sh, unsigned long newsize);
+
+/** Sum of the shards' ht_stats, each shard locked in turn (max_chain is the
+    longest anywhere).*/
+void  sh_stats(sharded_t *sh, ht_stats_t *st);
+/** Add the counters of st into sum, as sh_stats does.*/
+void  sh_stats_add(ht_stats_t *sum, const ht_stats_t *st);
+
+void  free_sharded(sharded_t *sh);
+
+#endif
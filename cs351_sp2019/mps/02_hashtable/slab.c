@@ -0,0 +1,96 @@
+#include "slab.h"
+#include <stdlib.h>
+#include <string.h>
+
+// objects per slab block: the first block stays small for small tables,
+// later ones double up to the cap
+#define SLAB_FIRST 32
+#define SLAB_MAX   8192
+// arena block payload, bigger requests get a block of their own
+#define ARENA_BLOCK (64 * 1024)
+#define ROUND(n, a) (((n) + (a) - 1) & ~((unsigned long)(a) - 1))
+// block header: the link to the previous block, padded to malloc alignment
+#define HDR 16
+
+void slab_init(slab_t *s, unsigned long objsize) {
+  memset(s, 0, sizeof(slab_t));
+  s->objsize = ROUND(objsize < sizeof(void *) ? sizeof(void *) : objsize, sizeof(void *));
+  s->per_block = SLAB_FIRST;
+}
+
+void *slab_alloc(slab_t *s) {
+
+  void *p;
+
+  if ((p = s->free)) {
+    s->free = *(void **)p;
+    return p;
+  }
+  if (s->next == s->end) {
+    // block header is one aligned word linking the previous block
+    char *block = malloc(HDR + s->per_block * s->objsize);
+    *(void **)block = s->blocks;
+    s->blocks = block;
+    s->next = block + HDR;
+    s->end = s->next + s->per_block * s->objsize;
+    if (s->per_block < SLAB_MAX)
+      s->per_block *= 2;
+  }
+  p = s->next;
+  s->next += s->objsize;
+  return p;
+}
+
+void slab_free(slab_t *s, void *p) {
+  *(void **)p = s->free;
+  s->free = p;
+}
+
+static void free_blocks(void *block) {
+  while (block) {
+    void *next = *(void **)block;
+    free(block);
+    block = next;
+  }
+}
+
+void slab_destroy(slab_t *s) {
+  free_blocks(s->blocks);
+  memset(s, 0, sizeof(slab_t));
+}
+
+void arena_init(arena_t *a) {
+  memset(a, 0, sizeof(arena_t));
+  a->block_size = ARENA_BLOCK;
+}
+
+void *arena_alloc(arena_t *a, unsigned long n) {
+
+  char *p;
+
+  n = ROUND(n, sizeof(void *));
+  if (n > (unsigned long)(a->end - a->next)) {
+    unsigned long payload = n > a->block_size ? n : a->block_size;
+    char *block = malloc(HDR + payload);
+    *(void **)block = a->blocks;
+    a->blocks = block;
+    // an oversized request doesn't displace the current block's free space
+    if (payload > a->block_size)
+      return block + HDR;
+    a->next = block + HDR;
+    a->end = a->next + payload;
+  }
+  p = a->next;
+  a->next += n;
+  return p;
+}
+
+char *arena_strdup(arena_t *a, const char *s) {
+  unsigned long n = strlen(s) + 1;
+  return memcpy(arena_alloc(a, n), s, n);
+}
+
+void arena_destroy(arena_t *a) {
+  free_blocks(a->blocks);
+  memset(a, 0, sizeof(arena_t));
+}
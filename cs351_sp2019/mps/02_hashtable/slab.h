@@ -0,0 +1,40 @@
+#ifndef SLAB_T
+#define SLAB_T
+
+/**
+ * Pool allocators for the chained table.
+ *
+ * A slab hands out fixed-size objects carved from large blocks; freed
+ * objects go on a free list for reuse, and slab_destroy returns every block
+ * at once. An arena is a bump allocator for variable-size data (keys and
+ * values) with no per-object free at all.
+ */
+
+typedef struct slab {
+  unsigned long objsize;  // rounded up to hold the free-list link
+  unsigned long per_block;
+  void *free;             // freed objects, linked through their first word
+  char *next, *end;       // unused part of the newest block
+  void *blocks;           // all blocks, linked through their first word
+} slab_t;
+
+typedef struct arena {
+  char *next, *end;
+  void *blocks;
+  unsigned long block_size;
+} arena_t;
+
+/** Set up a slab of objsize objects; nothing is allocated until used. */
+void  slab_init(slab_t *s, unsigned long objsize);
+void *slab_alloc(slab_t *s);
+void  slab_free(slab_t *s, void *p);
+/** Release every block; all objects from the slab become invalid. */
+void  slab_destroy(slab_t *s);
+
+void  arena_init(arena_t *a);
+/** n bytes, pointer aligned. */
+void *arena_alloc(arena_t *a, unsigned long n);
+char *arena_strdup(arena_t *a, const char *s);
+void  arena_destroy(arena_t *a);
+
+#endif
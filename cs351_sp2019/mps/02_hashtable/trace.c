@@ -0,0 +1,182 @@
+#include "trace.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static inline int is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/* Next whitespace-separated token at *pos, NUL-terminated in place; NULL at
+   the end. A last token with no whitespace after it has nowhere for its NUL
+   in the mapping and is copied to t->tail instead. */
+static char *next_token(trace_t *t, char **pos, char *end) {
+
+  char *p = *pos, *tok;
+
+  while (p < end && is_space(*p))
+    p++;
+  if (p == end)
+    return *pos = p, NULL;
+  tok = p;
+  while (p < end && !is_space(*p))
+    p++;
+  if (p == end) {
+    t->tail = strndup(tok, p - tok);
+    *pos = p;
+    return t->tail;
+  }
+  *p = '\0';
+  *pos = p + 1;
+  return tok;
+}
+
+static int load_text(trace_t *t) {
+
+  char *pos = t->map, *end = t->map + t->map_len, *tok;
+  unsigned long cap = 1024;
+  trace_op_t *op;
+
+  if ((tok = next_token(t, &pos, end)))
+    t->size = strtoul(tok, NULL, 10);
+  t->ops = malloc(cap * sizeof(trace_op_t));
+  while ((tok = next_token(t, &pos, end))) {
+    if (t->nops == cap) {
+      cap *= 2;
+      t->ops = realloc(t->ops, cap * sizeof(trace_op_t));
+    }
+    op = &t->ops[t->nops];
+    memset(op, 0, sizeof(trace_op_t));
+    op->type = tok[0];
+    switch (tok[0]) {
+    case 'p':
+      op->key = next_token(t, &pos, end);
+      op->val = next_token(t, &pos, end);
+      break;
+    case 'g':
+    case 'd':
+      op->key = next_token(t, &pos, end);
+      break;
+    case 'r':
+      if ((tok = next_token(t, &pos, end)))
+        op->num = strtoul(tok, NULL, 10);
+      break;
+    case 'i':
+      break;
+    default:
+      // the ops before it still run: the bad one ends the trace for the
+      // driver to report when it gets there
+      t->nops++;
+      return 1;
+    }
+    // a directive cut off by the end of the file is dropped, as fscanf would
+    if ((op->type == 'p' && !op->val) || ((op->type == 'g' || op->type == 'd') && !op->key))
+      break;
+    t->nops++;
+  }
+  return 1;
+}
+
+/* String at off, NULL for TRACE_NOSTR or an offset that isn't one: its
+   length must be just before it and its NUL inside the string area. */
+static char *bin_string(char *strings, unsigned long strbytes, unsigned long off) {
+  uint32_t len;
+
+  if (off < sizeof(len) || off >= strbytes)
+    return NULL;
+  memcpy(&len, strings + off - sizeof(len), sizeof(len));
+  if (len >= strbytes - off || strings[off + len] != '\0')
+    return NULL;
+  return strings + off;
+}
+
+static int load_bin(trace_t *t) {
+
+  trace_bin_header_t *h = (trace_bin_header_t *)t->map;
+  trace_bin_op_t *rec = (trace_bin_op_t *)(h + 1);
+  unsigned long i, key;
+  char *strings;
+
+  if (t->map_len < sizeof(*h) ||
+      (t->map_len - sizeof(*h)) / sizeof(*rec) < h->nops ||
+      t->map_len - sizeof(*h) - h->nops * sizeof(*rec) < h->strbytes) {
+    printf("Truncated binary tracefile\n");
+    return 0;
+  }
+  strings = (char *)(rec + h->nops);
+  t->size = h->size;
+  t->nops = h->nops;
+  t->ops = malloc((h->nops ? h->nops : 1) * sizeof(trace_op_t));
+  for (i = 0; i < h->nops; i++) {
+    t->ops[i].type = rec[i].op >> 56;
+    key = rec[i].op & TRACE_NOSTR;
+    t->ops[i].key = bin_string(strings, h->strbytes, key);
+    if (t->ops[i].type == 'p') {
+      t->ops[i].val = bin_string(strings, h->strbytes, rec[i].arg);
+      t->ops[i].num = 0;
+    } else {
+      t->ops[i].val = NULL;
+      t->ops[i].num = rec[i].arg;
+    }
+    // as in a text trace, an unknown directive is the last op
+    if (!strchr("pgdri", t->ops[i].type) || !t->ops[i].type) {
+      t->nops = i + 1;
+      break;
+    }
+    if ((key != TRACE_NOSTR && !t->ops[i].key) ||
+        ((t->ops[i].type == 'g' || t->ops[i].type == 'd') && !t->ops[i].key) ||
+        (t->ops[i].type == 'p' && (!t->ops[i].key || !t->ops[i].val))) {
+      printf("Bad string in binary tracefile\n");
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int trace_load(trace_t *t, const char *filename) {
+
+  struct stat st;
+  int fd, ok;
+
+  memset(t, 0, sizeof(trace_t));
+  if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    printf("Error opening tracefile %s\n", filename);
+    if (fd >= 0)
+      close(fd);
+    return 0;
+  }
+  t->map_len = st.st_size;
+  if (t->map_len) {
+    // private and writable: tokenizing writes NULs into our copy only
+    t->map = mmap(NULL, t->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (t->map == MAP_FAILED) {
+      printf("Error opening tracefile %s\n", filename);
+      close(fd);
+      t->map = NULL;
+      return 0;
+    }
+    madvise(t->map, t->map_len, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  if (t->map_len >= sizeof(trace_bin_header_t) && memcmp(t->map, TRACE_MAGIC, 8) == 0)
+    ok = load_bin(t);
+  else
+    ok = load_text(t);
+  if (!ok)
+    trace_free(t);
+  return ok;
+}
+
+void trace_free(trace_t *t) {
+  if (t->map)
+    munmap(t->map, t->map_len);
+  free(t->ops);
+  free(t->tail);
+  memset(t, 0, sizeof(trace_t));
+}
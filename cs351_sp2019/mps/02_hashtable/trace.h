@@ -0,0 +1,59 @@
+#ifndef TRACE_T
+#define TRACE_T
+
+/**
+ * Trace files for the drivers, loaded through mmap.
+ *
+ * Text traces (first token the table size, then p KEY VAL / g KEY / d KEY /
+ * r SIZE / i directives) are tokenized in place in a private mapping: keys
+ * and values point straight into it, NUL-terminated where the whitespace
+ * was. Binary traces, made by trace2bin, need no tokenizing at all.
+ *
+ * Binary layout, all words 64-bit native-endian:
+ *   header  "HTTRACE2", size, nops, strbytes
+ *   ops     nops records {op, arg}: op is type << 56 | key offset, arg the
+ *           value offset ('p') or the number ('r'); offsets point into the
+ *           string area, TRACE_NOSTR if absent
+ *   strings each distinct string once: a 32-bit length, the bytes, then a
+ *           NUL; offsets point at the bytes, so strings are usable in place
+ */
+
+#define TRACE_MAGIC "HTTRACE2"
+#define TRACE_NOSTR ((1UL << 56) - 1)
+#define TRACE_OP(type, key) ((unsigned long)(type) << 56 | (key))
+
+/** Binary file header and op record (see above). */
+typedef struct trace_bin_header {
+  char magic[8];
+  unsigned long size, nops, strbytes;
+} trace_bin_header_t;
+
+typedef struct trace_bin_op {
+  unsigned long op, arg;
+} trace_bin_op_t;
+
+typedef struct trace_op {
+  char type;        // 'p', 'g', 'd', 'r' or 'i'
+  char *key, *val;  // NULL where the directive has none
+  unsigned long num;
+} trace_op_t;
+
+typedef struct trace {
+  unsigned long size;  // table size from the first line
+  unsigned long nops;
+  trace_op_t *ops;
+  char *map;           // the mapping keys and values point into
+  unsigned long map_len;
+  char *tail;          // last token, if the file didn't end in whitespace
+} trace_t;
+
+/** Load a text or binary trace (told apart by the magic). Prints the
+    drivers' usual message and returns 0 if the file can't be opened, or
+    if a binary one is truncated or has an op whose strings aren't there.
+    An unknown directive ends the ops, as an op of that type: the drivers
+    run those before it, then report it, as they always have. */
+int  trace_load(trace_t *t, const char *filename);
+/** Unmap and free everything; the ops' strings become invalid. */
+void trace_free(trace_t *t);
+
+#endif
@@ -0,0 +1,86 @@
+/**
+  Compile a text trace into the binary trace format (trace.h), which the
+  drivers load without any tokenizing. Each distinct key or value is
+  stored once.
+
+  Usage: trace2bin TRACEFILE_NAME BINARY_TRACE
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashtable.h"
+#include "trace.h"
+
+static FILE *out;
+static hashtable_t *seen;   // string -> malloc'd offset
+static unsigned long strbytes;
+
+// offset of s in the string area, appending it the first time
+static unsigned long put_string(const char *s) {
+
+  unsigned long *off;
+  uint32_t len;
+
+  if (!s)
+    return TRACE_NOSTR;
+  if ((off = ht_get(seen, (char *)s)))
+    return *off;
+
+  len = strlen(s);
+  fwrite(&len, sizeof(len), 1, out);
+  fwrite(s, 1, len + 1, out);
+  off = malloc(sizeof(unsigned long));
+  *off = strbytes + sizeof(len);
+  strbytes += sizeof(len) + len + 1;
+  ht_put(seen, strdup(s), off);
+  return *off;
+}
+
+int main(int argc, char *argv[]) {
+  trace_bin_header_t h;
+  trace_bin_op_t *recs;
+  trace_op_t *op;
+  unsigned long i;
+  trace_t t;
+
+  if (argc != 3) {
+    printf("Usage: %s TRACEFILE_NAME BINARY_TRACE\n", argv[0]);
+    exit(0);
+  }
+  if (!trace_load(&t, argv[1]))
+    exit(1);
+  if ((out = fopen(argv[2], "wb")) == NULL) {
+    printf("Error writing %s\n", argv[2]);
+    exit(1);
+  }
+
+  // strings go after the records: write them first, at their final place
+  recs = calloc(t.nops ? t.nops : 1, sizeof(trace_bin_op_t));
+  seen = make_hashtable(t.nops / 2 + 1);
+  fseek(out, sizeof(h) + t.nops * sizeof(trace_bin_op_t), SEEK_SET);
+  for (i = 0; i < t.nops; i++) {
+    op = &t.ops[i];
+    recs[i].op = TRACE_OP(op->type, put_string(op->key));
+    recs[i].arg = op->type == 'p' ? put_string(op->val) : op->num;
+  }
+
+  memcpy(h.magic, TRACE_MAGIC, 8);
+  h.size = t.size;
+  h.nops = t.nops;
+  h.strbytes = strbytes;
+  rewind(out);
+  fwrite(&h, sizeof(h), 1, out);
+  fwrite(recs, sizeof(trace_bin_op_t), t.nops, out);
+  if (fclose(out) != 0) {
+    printf("Error writing %s\n", argv[2]);
+    exit(1);
+  }
+  printf("%lu ops, %lu bytes of strings, table size %lu\n", t.nops, strbytes, t.size);
+
+  free(recs);
+  free_hashtable(seen);
+  trace_free(&t);
+  return 0;
+}
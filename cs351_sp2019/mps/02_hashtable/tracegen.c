@@ -0,0 +1,402 @@
+/**
+  Synthetic trace generator: writes a trace in the p/g/d/r/i text format the
+  drivers read, or (-b) in the binary format of trace.h, at any scale.
+
+  Keys are drawn from a keyspace of KEYS ids. Key id i always spells the
+  same string: i in base 62, fixed width, padded with filler to a length
+  picked for i from MIN..MAX, so keys are unique and repeatable. Ids are
+  picked uniformly, Zipf-distributed (rank 1 hottest, ranks scattered over
+  the keyspace), or hotspot: FRAC of the keyspace gets SHARE of the
+  accesses. Each operation is a put, get or delete by the -m mix. -R adds a
+  rehash every N operations, to the current size times each FACTOR in
+  turn; -I a stats directive every N. The same options and -S seed always
+  give the same trace.
+
+  Usage: tracegen [-n OPS] [-k KEYS] [-s SIZE] [-L MIN[,MAX]] [-V LEN]
+                  [-d uniform|zipf:S|hot:FRAC,SHARE] [-m PUT,GET,DEL] [-p]
+                  [-R N,FACTOR[,FACTOR...]] [-I N] [-S SEED] [-b] -o OUT
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace.h"
+
+#define MAX_KEY 255
+#define MAX_FACTORS 16
+
+static const char digits[] =
+  "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+static unsigned long nkeys = 1000000, key_min = 8, key_max = 8, key_width;
+static unsigned long val_len = 8;
+static uint64_t rng_state;
+
+// splitmix64: fast, and one seed fixes the whole trace
+static uint64_t rng(void) {
+  uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// uniform in [0, 1)
+static double rng_unit(void) {
+  return (rng() >> 11) * (1.0 / (1UL << 53));
+}
+
+// the same mixing, as a function of a value (key lengths and filler)
+static uint64_t mix(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// key id -> its string in buf; returns the length
+static unsigned long make_key(unsigned long id, char *buf) {
+  unsigned long len = key_min + mix(id) % (key_max - key_min + 1), i;
+  uint64_t fill = mix(~id);
+
+  for (i = key_width; i-- > 0; id /= 62)
+    buf[i] = digits[id % 62];
+  for (i = key_width; i < len; i++, fill = mix(fill))
+    buf[i] = digits[fill % 62];
+  buf[len] = '\0';
+  return len;
+}
+
+static unsigned long make_val(unsigned long n, char *buf) {
+  unsigned long i;
+  for (i = val_len; i-- > 0; n /= 62)
+    buf[i] = digits[n % 62];
+  buf[val_len] = '\0';
+  return val_len;
+}
+
+/* Zipf ranks 1..n with exponent s by rejection-inversion (Hörmann and
+   Derflinger), so setup is O(1) even for a billion keys. */
+static double zipf_s, zipf_hx1, zipf_hn, zipf_cut;
+
+static double zipf_helper1(double x) {
+  return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x * (1 / 3.0 - 0.25 * x));
+}
+
+static double zipf_helper2(double x) {
+  return fabs(x) > 1e-8 ? expm1(x) / x : 1 + x / 2 * (1 + x / 3 * (1 + x / 4));
+}
+
+static double zipf_h(double x) {
+  return exp(-zipf_s * log(x));
+}
+
+static double zipf_hint(double x) {
+  double lx = log(x);
+  return zipf_helper2((1 - zipf_s) * lx) * lx;
+}
+
+static double zipf_hint_inv(double x) {
+  double t = x * (1 - zipf_s);
+  if (t < -1)
+    t = -1;
+  return exp(zipf_helper1(t) * x);
+}
+
+static void zipf_init(double s, unsigned long n) {
+  zipf_s = s;
+  zipf_hx1 = zipf_hint(1.5) - 1;
+  zipf_hn = zipf_hint(n + 0.5);
+  zipf_cut = 2 - zipf_hint_inv(zipf_hint(2.5) - zipf_h(2));
+}
+
+static unsigned long zipf_rank(unsigned long n) {
+  for (;;) {
+    double u = zipf_hn + rng_unit() * (zipf_hx1 - zipf_hn);
+    double x = zipf_hint_inv(u);
+    unsigned long k = x + 0.5;
+    if (k < 1)
+      k = 1;
+    else if (k > n)
+      k = n;
+    if (k - x <= zipf_cut || u >= zipf_hint(k + 0.5) - zipf_h(k))
+      return k;
+  }
+}
+
+// access distributions
+enum { DIST_UNIFORM, DIST_ZIPF, DIST_HOT };
+static int dist = DIST_UNIFORM;
+static double hot_frac = 0.2, hot_share = 0.8;
+static unsigned long scatter;  // coprime to nkeys: rank -> id is a bijection
+
+static unsigned long gcd(unsigned long a, unsigned long b) {
+  while (b) {
+    unsigned long t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+static unsigned long pick_key(void) {
+  unsigned long hot, rank;
+
+  switch (dist) {
+  case DIST_ZIPF:
+    // hot ranks spread over the keyspace instead of the lowest ids
+    return (zipf_rank(nkeys) - 1) * scatter % nkeys;
+  case DIST_HOT:
+    hot = nkeys * hot_frac;
+    if (hot == 0)
+      hot = 1;
+    // ranks below hot are the hot set; both sets go through the same
+    // scatter, so together they cover every id once
+    if (hot < nkeys && rng_unit() >= hot_share)
+      rank = hot + rng() % (nkeys - hot);
+    else
+      rank = rng() % hot;
+    return rank * scatter % nkeys;
+  default:
+    return rng() % nkeys;
+  }
+}
+
+/* Output. Text goes straight to out. Binary op records are written through
+   out at their place after the header, and strings through strs, a second
+   stream on the same file positioned after all the records. Each distinct
+   string goes there once, as trace.h has it: key id i's offset is kept in
+   key_off[i], and the value of op n, which spells n modulo val_space, in
+   val_off[n % val_space] (no val_off when no two ops share a value). 0
+   means not written yet. */
+static FILE *out, *strs;
+static int binary;
+static unsigned long nops_written, strbytes;
+static unsigned long *key_off, *val_off, val_space;
+
+static unsigned long put_string(unsigned long *off, const char *s, unsigned long len) {
+  uint32_t n = len;
+
+  if (*off)
+    return *off;
+  *off = strbytes + sizeof(n);
+  fwrite(&n, sizeof(n), 1, strs);
+  fwrite(s, 1, len + 1, strs);
+  strbytes += sizeof(n) + len + 1;
+  return *off;
+}
+
+// op type on key id (p/g/d), with a value made for it (p), or of num (r)
+static void emit(char type, unsigned long id, unsigned long num) {
+  char key[MAX_KEY + 1], val[MAX_KEY + 1];
+  unsigned long klen = 0, vlen = 0, fresh = 0, n = nops_written++;
+  trace_bin_op_t rec;
+
+  if (type == 'p' || type == 'g' || type == 'd')
+    klen = make_key(id, key);
+  if (type == 'p')
+    vlen = make_val(n, val);
+  if (!binary) {
+    if (type == 'p')
+      fprintf(out, "p %s %s\n", key, val);
+    else if (type == 'g' || type == 'd')
+      fprintf(out, "%c %s\n", type, key);
+    else if (type == 'r')
+      fprintf(out, "r %lu\n", num);
+    else
+      fprintf(out, "i\n");
+    return;
+  }
+  rec.op = TRACE_OP(type, klen ? put_string(&key_off[id], key, klen) : TRACE_NOSTR);
+  if (type == 'p')
+    rec.arg = put_string(val_off ? &val_off[n % val_space] : &fresh, val, vlen);
+  else
+    rec.arg = num;
+  fwrite(&rec, sizeof(rec), 1, out);
+}
+
+static void usage(char *prog) {
+  printf("Usage: %s [-n OPS] [-k KEYS] [-s SIZE] [-L MIN[,MAX]] [-V LEN]\n"
+         "       [-d uniform|zipf:S|hot:FRAC,SHARE] [-m PUT,GET,DEL] [-p]\n"
+         "       [-R N,FACTOR[,FACTOR...]] [-I N] [-S SEED] [-b] -o OUT\n", prog);
+  printf("  -n OPS      operations after any preload (default 1000000)\n");
+  printf("  -k KEYS     keyspace size (default 1000000)\n");
+  printf("  -s SIZE     initial table size (default KEYS)\n");
+  printf("  -L MIN,MAX  key lengths, uniform per key (default 8)\n");
+  printf("  -V LEN      value length (default 8)\n");
+  printf("  -d DIST     key popularity: uniform, zipf:S, or hot:FRAC,SHARE\n");
+  printf("  -m P,G,D    relative weights of puts, gets and deletes (default 50,45,5)\n");
+  printf("  -p          put every key once first, in scattered order\n");
+  printf("  -R N,F...   rehash every N ops to the size times each factor in turn\n");
+  printf("  -I N        stats directive every N ops\n");
+  printf("  -S SEED     random seed (default 1)\n");
+  printf("  -b          binary trace (trace.h) instead of text\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long ops = 1000000, size = 0, resize_every = 0, stats_every = 0;
+  unsigned long i, id, nfactors = 0, w, init_size;
+  double mix_put = 50, mix_get = 45, mix_del = 5, factors[MAX_FACTORS], r;
+  char *outname = NULL, *arg, *end;
+  trace_bin_header_t h;
+  int c, preload = 0;
+
+  rng_state = 1;
+  while ((c = getopt(argc, argv, "n:k:s:L:V:d:m:pR:I:S:bo:")) != -1) {
+    switch (c) {
+    case 'n':
+      ops = strtoul(optarg, NULL, 10);
+      break;
+    case 'k':
+      nkeys = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      size = strtoul(optarg, NULL, 10);
+      break;
+    case 'L':
+      if (sscanf(optarg, "%lu,%lu", &key_min, &key_max) == 1)
+        key_max = key_min;
+      break;
+    case 'V':
+      val_len = strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      if (strcmp(optarg, "uniform") == 0) {
+        dist = DIST_UNIFORM;
+      } else if (strncmp(optarg, "zipf:", 5) == 0) {
+        dist = DIST_ZIPF;
+        zipf_s = strtod(optarg + 5, NULL);
+      } else if (sscanf(optarg, "hot:%lf,%lf", &hot_frac, &hot_share) == 2) {
+        dist = DIST_HOT;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'm':
+      if (sscanf(optarg, "%lf,%lf,%lf", &mix_put, &mix_get, &mix_del) != 3)
+        usage(argv[0]);
+      break;
+    case 'p':
+      preload = 1;
+      break;
+    case 'R':
+      resize_every = strtoul(optarg, &arg, 10);
+      while (*arg == ',' && nfactors < MAX_FACTORS) {
+        factors[nfactors] = strtod(arg + 1, &end);
+        if (end == arg + 1)
+          usage(argv[0]);
+        nfactors++;
+        arg = end;
+      }
+      break;
+    case 'I':
+      stats_every = strtoul(optarg, NULL, 10);
+      break;
+    case 'S':
+      rng_state = strtoul(optarg, NULL, 0);
+      break;
+    case 'b':
+      binary = 1;
+      break;
+    case 'o':
+      outname = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (!outname || nkeys == 0 || mix_put + mix_get + mix_del <= 0 ||
+      (dist == DIST_ZIPF && zipf_s <= 0) || (resize_every && nfactors == 0))
+    usage(argv[0]);
+
+  // fixed-width id digits come first, so every key must have room for them
+  for (key_width = 1, w = 62; w < nkeys; w *= 62)
+    key_width++;
+  if (key_min < key_width)
+    key_min = key_width;
+  if (key_max < key_min)
+    key_max = key_min;
+  if (key_max > MAX_KEY || val_len > MAX_KEY || val_len == 0) {
+    printf("Keys and values are limited to %d characters\n", MAX_KEY);
+    exit(1);
+  }
+  if (size == 0)
+    size = nkeys;
+  init_size = size;
+  if (dist == DIST_ZIPF)
+    zipf_init(zipf_s, nkeys);
+  for (scatter = 2654435761UL; gcd(scatter, nkeys) != 1; scatter += 2)
+    ;
+
+  if ((out = fopen(outname, "wb")) == NULL) {
+    printf("Error writing %s\n", outname);
+    exit(1);
+  }
+  if (binary) {
+    // the op count is known up front: strings start right after the records
+    unsigned long total = ops + (preload ? nkeys : 0) +
+                          (resize_every ? ops / resize_every : 0) +
+                          (stats_every ? ops / stats_every : 0);
+    memset(&h, 0, sizeof(h));
+    fwrite(&h, sizeof(h), 1, out);
+    key_off = calloc(nkeys, sizeof(unsigned long));
+    // values only repeat once the op count reaches 62^val_len
+    for (val_space = 1, w = 0; w < val_len && val_space < total; w++)
+      val_space *= 62;
+    if (val_space < total)
+      val_off = calloc(val_space, sizeof(unsigned long));
+    if ((strs = fopen(outname, "r+b")) == NULL ||
+        fseek(strs, sizeof(h) + total * sizeof(trace_bin_op_t), SEEK_SET) != 0) {
+      printf("Error writing %s\n", outname);
+      exit(1);
+    }
+  } else {
+    fprintf(out, "%lu\n", size);
+  }
+
+  if (preload) {
+    for (i = 0; i < nkeys; i++) {
+      emit('p', i * scatter % nkeys, 0);
+    }
+  }
+  for (i = 1; i <= ops; i++) {
+    id = pick_key();
+    r = rng_unit() * (mix_put + mix_get + mix_del);
+    if (r < mix_put)
+      emit('p', id, 0);
+    else if (r < mix_put + mix_get)
+      emit('g', id, 0);
+    else
+      emit('d', id, 0);
+    if (resize_every && i % resize_every == 0) {
+      size = size * factors[(i / resize_every - 1) % nfactors];
+      if (size == 0)
+        size = 1;
+      emit('r', 0, size);
+    }
+    if (stats_every && i % stats_every == 0)
+      emit('i', 0, 0);
+  }
+
+  if (binary) {
+    memcpy(h.magic, TRACE_MAGIC, 8);
+    h.size = init_size;
+    h.nops = nops_written;
+    h.strbytes = strbytes;
+    if (fclose(strs) != 0) {
+      printf("Error writing %s\n", outname);
+      exit(1);
+    }
+    rewind(out);
+    fwrite(&h, sizeof(h), 1, out);
+    free(key_off);
+    free(val_off);
+  }
+  if (fclose(out) != 0) {
+    printf("Error writing %s\n", outname);
+    exit(1);
+  }
+  return 0;
+}